@@ -0,0 +1,120 @@
+#include "async_locator.h"
+
+#include <algorithm>
+
+AsyncLocator::AsyncLocator(const IndexedPolygons &index, Engine engine, int threads, size_t max_batch)
+    : own_handle(std::make_unique<IndexHandle>(
+          std::shared_ptr<const IndexedPolygons>(&index, [](const IndexedPolygons *) {}))),
+      handle(own_handle.get()), engine(engine), max_batch(std::max<size_t>(1, max_batch)) {
+    this->start(threads);
+}
+
+AsyncLocator::AsyncLocator(IndexHandle &handle, Engine engine, int threads, size_t max_batch)
+    : handle(&handle), engine(engine), max_batch(std::max<size_t>(1, max_batch)) {
+    this->start(threads);
+}
+
+void AsyncLocator::start(int threads) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; ++i) {
+        this->workers.emplace_back([this] { this->work(); });
+    }
+}
+
+AsyncLocator::~AsyncLocator() {
+    std::deque<Request *> left;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto &worker: this->workers) worker.join();
+
+    // Nothing else touches the queue once the workers are gone.
+    left.swap(this->queue);
+    for (auto *request: left) {
+        request->cancelled = true;
+        request->handle.resume();
+    }
+}
+
+void AsyncLocator::enqueue(Request *request) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.push_back(request);
+    }
+    this->wake.notify_one();
+}
+
+void AsyncLocator::cancel(Request *request) {
+    // Only flags the request: resuming here could run the caller inline on
+    // whatever thread requested the stop. A worker picks it up right away.
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        request->cancelled = true;
+    }
+    this->wake.notify_one();
+}
+
+void AsyncLocator::work() {
+    std::vector<Request *> batch, cancelled;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [&] {
+                return this->stopping || !this->queue.empty();
+            });
+            if (this->stopping) return;
+
+            // Cancelled requests leave the queue wherever they are.
+            const auto first_cancelled = std::stable_partition(this->queue.begin(), this->queue.end(),
+                                                               [](Request *r) { return !r->cancelled; });
+            cancelled.assign(first_cancelled, this->queue.end());
+            this->queue.erase(first_cancelled, this->queue.end());
+
+            // Then as many whole requests as fit in one micro-batch, and at
+            // least one so oversized requests still run.
+            size_t points = 0;
+            while (!this->queue.empty() &&
+                   (batch.empty() || points + this->queue.front()->points.size() <= this->max_batch)) {
+                points += this->queue.front()->points.size();
+                batch.push_back(this->queue.front());
+                this->queue.pop_front();
+            }
+        }
+
+        for (auto *request: cancelled) request->handle.resume();
+        cancelled.clear();
+
+        const auto index = this->handle->acquire();
+        for (auto *request: batch) {
+            request->result.resize(request->points.size());
+            size_t i = 0;
+            for (; i < request->points.size(); ++i) {
+                // Checked every so often so large cancelled requests stop early.
+                if (i % 1024 == 0 && request->cancelled) break;
+                index->search(request->points[i], this->engine, request->result[i]);
+            }
+            request->completed = i == request->points.size();
+        }
+        for (auto *request: batch) request->handle.resume();
+        batch.clear();
+    }
+}
+
+void AsyncLocator::Operation::await_suspend(std::coroutine_handle<> handle) {
+    this->request.handle = handle;
+    // The stop callback goes in before the request is queued: once it is, a
+    // worker may resume the caller and destroy this object at any moment.
+    if (this->request.stop.stop_possible()) {
+        this->on_stop.emplace(this->request.stop, Canceller{this->locator, &this->request});
+    }
+    this->locator->enqueue(&this->request);
+}
+
+AsyncLocator::Result AsyncLocator::Operation::await_resume() {
+    if (!this->request.completed) {
+        throw LocateCancelled();
+    }
+    return std::move(this->request.result);
+}
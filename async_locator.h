@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+#include "locator.h"
+#include "index_handle.h"
+
+// Thrown from co_await AsyncLocator::locate() when the request was cancelled
+// through its stop token, or the locator shut down before running it.
+class LocateCancelled : public std::runtime_error {
+public:
+    LocateCancelled() : std::runtime_error("locate request cancelled") {}
+};
+
+// Coroutine front end for embedding the locator in an async service:
+//
+//     auto observations = co_await locator.locate(points, stop_token);
+//
+// Requests are queued for a small internal worker pool instead of blocking
+// the caller's thread. A worker takes every queued request that fits in one
+// micro-batch of max_batch points, runs them back to back and resumes each
+// awaiting coroutine on the worker thread, so many small lookups share the
+// pool without a thread per request. Callers that need to continue on their
+// own event loop should hop back to it after the co_await.
+//
+// The index must outlive the locator and be built (force_build(), and
+// build_cell_table() for Engine::cells) before the first request. Given an
+// IndexHandle instead, each micro-batch runs on the version current when it
+// starts, so the index can be swapped while requests are in flight.
+class AsyncLocator {
+public:
+    using Result = std::vector<std::vector<ObservationHandle> >;
+
+private:
+    // A suspended locate() call. Lives in the awaiting coroutine's frame.
+    struct Request {
+        std::vector<S2Point> points;
+        Result result;
+        std::coroutine_handle<> handle;
+        std::atomic<bool> cancelled{false};
+        bool completed = false; // every point was looked up
+        std::stop_token stop;
+    };
+
+    std::unique_ptr<IndexHandle> own_handle; // wraps a plain index
+    IndexHandle *handle;
+    Engine engine;
+    size_t max_batch;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request *> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void start(int threads);
+    void enqueue(Request *request);
+    void cancel(Request *request);
+    void work();
+
+public:
+    // The awaitable returned by locate().
+    class Operation {
+        struct Canceller {
+            AsyncLocator *locator;
+            Request *request;
+
+            void operator()() const noexcept {
+                this->locator->cancel(this->request);
+            }
+        };
+
+        AsyncLocator *locator;
+        Request request;
+        // Declared last so it is destroyed first, waiting out a callback that
+        // is still running on another thread.
+        std::optional<std::stop_callback<Canceller> > on_stop;
+
+    public:
+        Operation(AsyncLocator *locator, std::vector<S2Point> points, std::stop_token stop)
+            : locator(locator) {
+            this->request.points = std::move(points);
+            this->request.stop = std::move(stop);
+        }
+
+        Operation(const Operation &) = delete;
+        Operation &operator=(const Operation &) = delete;
+
+        bool await_ready() noexcept {
+            if (this->request.stop.stop_requested()) return true;
+            this->request.completed = this->request.points.empty();
+            return this->request.completed;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        // The footprints containing each point, in the order of the points.
+        Result await_resume();
+    };
+
+    explicit AsyncLocator(const IndexedPolygons &index, Engine engine = Engine::index, int threads = 0,
+                          size_t max_batch = 4096);
+    explicit AsyncLocator(IndexHandle &handle, Engine engine = Engine::index, int threads = 0,
+                          size_t max_batch = 4096);
+
+    // Stops the workers. Requests still queued are resumed with LocateCancelled.
+    ~AsyncLocator();
+
+    AsyncLocator(const AsyncLocator &) = delete;
+    AsyncLocator &operator=(const AsyncLocator &) = delete;
+
+    // Looks up a batch of points. Requesting a stop on the token before the
+    // batch has finished resumes the caller with LocateCancelled.
+    Operation locate(std::vector<S2Point> points, std::stop_token stop = {}) {
+        return Operation(this, std::move(points), std::move(stop));
+    }
+};
@@ -0,0 +1,375 @@
+// Synthetic catalog generator for the scaling benchmarks. Writes ID,ra,dec CSVs
+// in the format tesslocate expects, at any size from a handful of rows to 10^9.
+//
+// Every row is a pure function of (seed, row number), so a catalog can be
+// regenerated in any order without holding it in memory: "shuffled" simply
+// emits rows in ID order (which is spatially random), while "sorted" emits them
+// ordered by declination using repeated passes over declination bands that each
+// fit in --sort-memory.
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../external/cxxopts.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kDeg = kPi / 180.0;
+
+// Number of declination bins used to plan the passes of a sorted run.
+constexpr int kSortBins = 1 << 16;
+
+// Rows formatted per parallel work unit.
+constexpr uint64_t kChunkRows = 1 << 16;
+
+enum class Distribution { uniform, ecliptic_poles, galactic_plane, clustered };
+
+struct Position {
+    double ra;
+    double dec;
+};
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Counter-based random stream: the k-th uniform in [0, 1) for a given row.
+class RowRandom {
+    uint64_t state;
+    uint64_t k = 0;
+
+public:
+    RowRandom(uint64_t seed, uint64_t row) : state(splitmix64(seed ^ splitmix64(row))) {}
+
+    uint64_t next_u64() { return splitmix64(state + k++ * 0x632be59bd9b4e019ULL); }
+    double next() { return (next_u64() >> 11) * 0x1.0p-53; }
+
+    double gaussian() {
+        double u1 = next(), u2 = next();
+        if (u1 < 1e-300) u1 = 1e-300;
+        return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * kPi * u2);
+    }
+};
+
+using Vec3 = std::array<double, 3>;
+
+static Vec3 to_vec(double lon, double lat) {
+    return {std::cos(lat * kDeg) * std::cos(lon * kDeg), std::cos(lat * kDeg) * std::sin(lon * kDeg),
+            std::sin(lat * kDeg)};
+}
+
+static Position to_radec(const Vec3 &v) {
+    double ra = std::atan2(v[1], v[0]) / kDeg;
+    if (ra < 0) ra += 360.0;
+    if (ra >= 360.0) ra -= 360.0;
+    double dec = std::asin(std::clamp(v[2], -1.0, 1.0)) / kDeg;
+    return {ra, dec};
+}
+
+// Rotates v by the row-major matrix m.
+static Vec3 rotate(const double (&m)[3][3], const Vec3 &v) {
+    return {m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2], m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]};
+}
+
+// Ecliptic (J2000, obliquity 23.4393 deg) to equatorial.
+static Position ecliptic_to_radec(double lon, double lat) {
+    const double e = 23.4393 * kDeg;
+    const double m[3][3] = {{1, 0, 0}, {0, std::cos(e), -std::sin(e)}, {0, std::sin(e), std::cos(e)}};
+    return to_radec(rotate(m, to_vec(lon, lat)));
+}
+
+// Galactic to equatorial (J2000), the transpose of the IAU equatorial-to-galactic matrix.
+static Position galactic_to_radec(double l, double b) {
+    const double m[3][3] = {{-0.0548755604, 0.4941094279, -0.8676661490},
+                            {-0.8734370902, -0.4448296300, -0.1980763734},
+                            {-0.4838350155, 0.7469822445, 0.4559837762}};
+    return to_radec(rotate(m, to_vec(l, b)));
+}
+
+// Offsets center by a random direction at the given angular distance (degrees).
+static Position offset(const Position &center, double distance, double bearing) {
+    const double dec0 = center.dec * kDeg, d = distance * kDeg;
+    const double dec = std::asin(std::clamp(
+        std::sin(dec0) * std::cos(d) + std::cos(dec0) * std::sin(d) * std::cos(bearing), -1.0, 1.0));
+    const double dra = std::atan2(std::sin(bearing) * std::sin(d) * std::cos(dec0),
+                                  std::cos(d) - std::sin(dec0) * std::sin(dec));
+    double ra = center.ra + dra / kDeg;
+    ra = std::fmod(ra, 360.0);
+    if (ra < 0) ra += 360.0;
+    return {ra, dec / kDeg};
+}
+
+struct Generator {
+    Distribution distribution = Distribution::uniform;
+    uint64_t seed = 1;
+    double duplicates = 0.0;
+    int clusters = 64;
+    double cluster_sigma = 0.5;
+    double plane_sigma = 5.0;
+    double pole_radius = 12.0;
+
+    Position uniform(RowRandom &r) const {
+        const double ra = 360.0 * r.next();
+        const double dec = std::asin(2.0 * r.next() - 1.0) / kDeg;
+        return {ra, dec};
+    }
+
+    // Position of the row before duplicate resolution.
+    Position sample(uint64_t row) const {
+        RowRandom r(seed, row);
+        switch (distribution) {
+            case Distribution::uniform:
+                return uniform(r);
+            case Distribution::ecliptic_poles: {
+                // Uniform within a cap around either ecliptic pole, i.e. the
+                // continuous viewing zones.
+                const double cos_r = std::cos(pole_radius * kDeg);
+                const double lat = std::acos(1.0 - r.next() * (1.0 - cos_r)) / kDeg;
+                const double lon = 360.0 * r.next();
+                return ecliptic_to_radec(lon, (r.next_u64() & 1) ? 90.0 - lat : lat - 90.0);
+            }
+            case Distribution::galactic_plane: {
+                const double l = 360.0 * r.next();
+                const double b = std::clamp(r.gaussian() * plane_sigma, -90.0, 90.0);
+                return galactic_to_radec(l, b);
+            }
+            case Distribution::clustered: {
+                const uint64_t cluster = r.next_u64() % clusters;
+                RowRandom cr(seed ^ 0x5bd1e995ULL, cluster);
+                const Position center = uniform(cr);
+                const double distance = std::abs(r.gaussian()) * cluster_sigma;
+                return offset(center, distance, 2.0 * kPi * r.next());
+            }
+        }
+        return {0, 0};
+    }
+
+    // Position of a row. A duplicate row reuses the position of an earlier row,
+    // which may itself be a duplicate; the chain always ends at a row below it.
+    Position position(uint64_t row) const {
+        while (duplicates > 0 && row > 0) {
+            RowRandom r(seed ^ 0xd1b54a32d192ed03ULL, row);
+            if (r.next() >= duplicates) break;
+            row = r.next_u64() % row;
+        }
+        return sample(row);
+    }
+};
+
+struct Row {
+    double dec;
+    double ra;
+    uint64_t id;
+};
+
+static void format_row(std::string &out, uint64_t id, const Position &p) {
+    char buf[64];
+    char *end = buf + sizeof(buf);
+    char *ptr = std::to_chars(buf, end, id).ptr;
+    *ptr++ = ',';
+    ptr = std::to_chars(ptr, end, p.ra, std::chars_format::fixed, 8).ptr;
+    *ptr++ = ',';
+    ptr = std::to_chars(ptr, end, p.dec, std::chars_format::fixed, 8).ptr;
+    *ptr++ = '\n';
+    out.append(buf, ptr);
+}
+
+static int dec_bin(double dec) {
+    return std::clamp(static_cast<int>((dec + 90.0) / 180.0 * kSortBins), 0, kSortBins - 1);
+}
+
+// Rows are emitted in ID order; each block of chunks is formatted in parallel
+// and written sequentially.
+static void write_shuffled(const Generator &gen, uint64_t rows, FILE *out) {
+    const uint64_t chunks = (rows + kChunkRows - 1) / kChunkRows;
+#ifdef USE_OPENMP
+    const uint64_t block = static_cast<uint64_t>(omp_get_max_threads()) * 4;
+#else
+    const uint64_t block = 1;
+#endif
+    std::vector<std::string> buffers(block);
+    for (uint64_t first = 0; first < chunks; first += block) {
+        const uint64_t count = std::min(block, chunks - first);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int64_t c = 0; c < static_cast<int64_t>(count); ++c) {
+            auto &buf = buffers[c];
+            buf.clear();
+            const uint64_t begin = (first + c) * kChunkRows;
+            const uint64_t end = std::min(rows, begin + kChunkRows);
+            for (uint64_t i = begin; i < end; ++i) {
+                format_row(buf, i + 1, gen.position(i));
+            }
+        }
+        for (uint64_t c = 0; c < count; ++c) {
+            fwrite(buffers[c].data(), 1, buffers[c].size(), out);
+        }
+    }
+}
+
+// Rows are emitted sorted by declination. A counting pass builds a histogram
+// over declination bins, consecutive bins are grouped into passes that fit the
+// memory budget, and each pass regenerates every row and keeps its own bins.
+static void write_sorted(const Generator &gen, uint64_t rows, uint64_t memory, FILE *out) {
+    std::vector<uint64_t> histogram(kSortBins, 0);
+#ifdef USE_OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<uint64_t> local(kSortBins, 0);
+#ifdef USE_OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int64_t i = 0; i < static_cast<int64_t>(rows); ++i) {
+            ++local[dec_bin(gen.position(i).dec)];
+        }
+#ifdef USE_OPENMP
+#pragma omp critical
+#endif
+        for (int b = 0; b < kSortBins; ++b) histogram[b] += local[b];
+    }
+
+    const uint64_t budget = std::max<uint64_t>(1, memory / sizeof(Row));
+    int bin = 0;
+    while (bin < kSortBins) {
+        int last = bin;
+        uint64_t count = histogram[bin];
+        while (last + 1 < kSortBins && count + histogram[last + 1] <= budget) {
+            count += histogram[++last];
+        }
+
+        std::vector<Row> pass;
+        pass.reserve(count);
+#ifdef USE_OPENMP
+#pragma omp parallel
+#endif
+        {
+            std::vector<Row> local;
+#ifdef USE_OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+            for (int64_t i = 0; i < static_cast<int64_t>(rows); ++i) {
+                const Position p = gen.position(i);
+                const int b = dec_bin(p.dec);
+                if (b >= bin && b <= last) local.push_back({p.dec, p.ra, static_cast<uint64_t>(i) + 1});
+            }
+#ifdef USE_OPENMP
+#pragma omp critical
+#endif
+            pass.insert(pass.end(), local.begin(), local.end());
+        }
+
+        std::sort(pass.begin(), pass.end(), [](const Row &a, const Row &b) {
+            if (a.dec != b.dec) return a.dec < b.dec;
+            if (a.ra != b.ra) return a.ra < b.ra;
+            return a.id < b.id;
+        });
+
+        std::string buf;
+        for (const auto &r: pass) {
+            format_row(buf, r.id, {r.ra, r.dec});
+            if (buf.size() > (1 << 20)) {
+                fwrite(buf.data(), 1, buf.size(), out);
+                buf.clear();
+            }
+        }
+        fwrite(buf.data(), 1, buf.size(), out);
+        bin = last + 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate-gen", "Generate synthetic catalogs for tesslocate benchmarks");
+    options.add_options()
+        ("output", "output csv path, or - for stdout", cxxopts::value<std::string>()->default_value("-"))
+        ("n,rows", "number of rows (accepts 1e6 style values)", cxxopts::value<std::string>()->default_value("1000"))
+        ("distribution", "uniform, ecliptic-poles, galactic-plane or clustered",
+         cxxopts::value<std::string>()->default_value("uniform"))
+        ("duplicates", "fraction of rows that repeat an earlier position",
+         cxxopts::value<double>()->default_value("0"))
+        ("clusters", "number of clusters for the clustered distribution", cxxopts::value<int>()->default_value("64"))
+        ("order", "shuffled (random sky order) or sorted (by declination)",
+         cxxopts::value<std::string>()->default_value("shuffled"))
+        ("sort-memory", "memory budget for sorted output, in MiB", cxxopts::value<uint64_t>()->default_value("1024"))
+        ("seed", "random seed", cxxopts::value<uint64_t>()->default_value("1"))
+        ("threads", "number of worker threads", cxxopts::value<int>())
+        ("h,help", "print usage");
+    options.parse_positional({"output"});
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    const double rows_value = std::stod(result["rows"].as<std::string>());
+    if (!(rows_value >= 0) || rows_value > 1e12) {
+        std::cerr << "Invalid number of rows." << std::endl;
+        return 1;
+    }
+    const auto rows = static_cast<uint64_t>(std::llround(rows_value));
+
+    Generator gen;
+    gen.seed = result["seed"].as<uint64_t>();
+    gen.duplicates = result["duplicates"].as<double>();
+    gen.clusters = std::max(1, result["clusters"].as<int>());
+    const auto distribution = result["distribution"].as<std::string>();
+    if (distribution == "uniform") {
+        gen.distribution = Distribution::uniform;
+    } else if (distribution == "ecliptic-poles") {
+        gen.distribution = Distribution::ecliptic_poles;
+    } else if (distribution == "galactic-plane") {
+        gen.distribution = Distribution::galactic_plane;
+    } else if (distribution == "clustered") {
+        gen.distribution = Distribution::clustered;
+    } else {
+        std::cerr << "Invalid distribution: " << distribution << std::endl;
+        return 1;
+    }
+    if (gen.duplicates < 0 || gen.duplicates >= 1) {
+        std::cerr << "--duplicates must be in [0, 1)." << std::endl;
+        return 1;
+    }
+
+    const auto order = result["order"].as<std::string>();
+    if (order != "shuffled" && order != "sorted") {
+        std::cerr << "Invalid order: " << order << std::endl;
+        return 1;
+    }
+
+#ifdef USE_OPENMP
+    if (result.count("threads")) omp_set_num_threads(result["threads"].as<int>());
+#endif
+
+    const auto output = result["output"].as<std::string>();
+    FILE *out = output == "-" ? stdout : fopen(output.c_str(), "wb");
+    if (!out) {
+        std::cerr << "Failed to open " << output << std::endl;
+        return 1;
+    }
+
+    fputs("ID,ra,dec\n", out);
+    if (order == "sorted") {
+        write_sorted(gen, rows, result["sort-memory"].as<uint64_t>() << 20, out);
+    } else {
+        write_shuffled(gen, rows, out);
+    }
+
+    if (out != stdout && fclose(out) != 0) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,464 @@
+// End-to-end scaling harness. Generates catalogs with tesslocate-gen, runs the
+// tesslocate CLI over a sweep of --threads values and writes a JSON report with
+// wall time, throughput, parallel efficiency and peak RSS for every run.
+//
+// Strong scaling keeps the catalog size fixed while the thread count grows;
+// weak scaling grows the catalog with the thread count. Each configuration is
+// repeated and summarised by its median. A run over a header-only catalog
+// measures the fixed startup cost (footprint loading and index construction),
+// which is reported separately so the query throughput can be read on its own.
+//
+// Reports double as regression baselines: `compare` matches the runs of two
+// reports by name and tests whether the difference in mean wall time is
+// significant given the spread of the repetitions (Welch's t interval), so a
+// dependency or compiler bump can be checked locally before it is merged.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../external/cxxopts.h"
+#include <nlohmann/json.hpp>
+
+using ojson = nlohmann::ordered_json;
+
+struct RunResult {
+    double seconds;
+    uint64_t peak_rss_bytes;
+};
+
+// Runs a command with stdout and stderr sent to log, returning its wall time and
+// peak resident set size. Throws if the command does not exit cleanly.
+static RunResult run(const std::vector<std::string> &args, const std::string &log) {
+    std::vector<char *> argv;
+    for (const auto &a: args) argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) < 0) throw std::runtime_error("wait4 failed");
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Command failed (see " + log + "): " + args[0]);
+    }
+
+#if defined(__APPLE__)
+    const uint64_t rss = usage.ru_maxrss; // bytes
+#else
+    const uint64_t rss = static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+    return {elapsed.count(), rss};
+}
+
+// Runs a command and returns its stdout split into lines.
+static std::vector<std::string> capture(const std::string &command) {
+    std::vector<std::string> lines;
+    FILE *pipe = popen(command.c_str(), "r");
+    if (!pipe) return lines;
+    char buf[512];
+    std::string line;
+    while (fgets(buf, sizeof(buf), pipe)) {
+        line += buf;
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+            lines.push_back(line);
+            line.clear();
+        }
+    }
+    if (!line.empty()) lines.push_back(line);
+    pclose(pipe);
+    return lines;
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+static std::vector<int> parse_threads(const std::string &list) {
+    std::vector<int> res;
+    std::istringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) res.push_back(std::stoi(item));
+    }
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+}
+
+static std::string default_threads() {
+    const int max = std::max(1u, std::thread::hardware_concurrency());
+    std::string res;
+    for (int t = 1; t < max; t *= 2) res += std::to_string(t) + ",";
+    return res + std::to_string(max);
+}
+
+static uint64_t parse_rows(const std::string &value) {
+    return static_cast<uint64_t>(std::llround(std::stod(value)));
+}
+
+struct Sweep {
+    std::string tesslocate;
+    std::string gen;
+    std::filesystem::path workdir;
+    std::string distribution;
+    int repetitions;
+    std::string log;
+
+    // Generates (or reuses) a catalog of the given size.
+    std::string catalog(uint64_t rows) {
+        auto path = workdir / ("catalog-" + distribution + "-" + std::to_string(rows) + ".csv");
+        if (!std::filesystem::exists(path)) {
+            std::cout << "Generating " << path.string() << std::endl;
+            auto tmp = path.string() + ".tmp";
+            run({gen, tmp, "--rows", std::to_string(rows), "--distribution", distribution}, log);
+            std::filesystem::rename(tmp, path);
+        }
+        return path.string();
+    }
+
+    ojson measure(const std::string &mode, int threads, uint64_t rows) {
+        const auto input = catalog(rows);
+        const auto output = (workdir / "output.csv").string();
+        std::vector<double> seconds;
+        uint64_t rss = 0;
+        for (int r = 0; r < repetitions; ++r) {
+            auto res = run({tesslocate, input, output, "--threads", std::to_string(threads)}, log);
+            seconds.push_back(res.seconds);
+            rss = std::max(rss, res.peak_rss_bytes);
+        }
+        std::filesystem::remove(output);
+
+        ojson j;
+        j["name"] = mode + "/threads=" + std::to_string(threads) + "/rows=" + std::to_string(rows);
+        j["mode"] = mode;
+        j["threads"] = threads;
+        j["rows"] = rows;
+        j["seconds"] = seconds;
+        j["median_seconds"] = median(seconds);
+        j["peak_rss_bytes"] = rss;
+        return j;
+    }
+};
+
+// Fills in throughput and efficiency relative to the smallest thread count of
+// the same mode.
+static void summarise(ojson &results, double startup) {
+    for (const std::string mode: {"strong", "weak"}) {
+        const ojson *base = nullptr;
+        for (auto &r: results) {
+            if (r["mode"] != mode) continue;
+            const double t = r["median_seconds"].get<double>();
+            const double rows = r["rows"].get<double>();
+            const int threads = r["threads"].get<int>();
+            r["rows_per_second"] = rows / t;
+            r["query_rows_per_second"] = t > startup ? rows / (t - startup) : 0.0;
+
+            if (!base) base = &r;
+            const double t0 = (*base)["median_seconds"].get<double>();
+            const int threads0 = (*base)["threads"].get<int>();
+            r["efficiency"] = mode == "strong" ? (t0 * threads0) / (t * threads) : t0 / t;
+        }
+    }
+}
+
+static int scale(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate-bench scale", "Strong and weak scaling sweeps over --threads");
+    options.add_options()
+        ("tesslocate", "path to the tesslocate binary", cxxopts::value<std::string>()->default_value("./tesslocate"))
+        ("gen", "path to the tesslocate-gen binary", cxxopts::value<std::string>()->default_value("./tesslocate-gen"))
+        ("mode", "strong, weak or both", cxxopts::value<std::string>()->default_value("both"))
+        ("rows", "catalog size for strong scaling", cxxopts::value<std::string>()->default_value("1e6"))
+        ("rows-per-thread", "catalog size per thread for weak scaling",
+         cxxopts::value<std::string>()->default_value("2.5e5"))
+        ("threads", "comma separated thread counts", cxxopts::value<std::string>()->default_value(default_threads()))
+        ("distribution", "catalog distribution passed to tesslocate-gen",
+         cxxopts::value<std::string>()->default_value("uniform"))
+        ("repetitions", "runs per configuration", cxxopts::value<int>()->default_value("3"))
+        ("workdir", "directory for generated catalogs and logs",
+         cxxopts::value<std::string>()->default_value("bench-work"))
+        ("report", "path of the JSON report", cxxopts::value<std::string>()->default_value("scaling.json"))
+        ("h,help", "print usage");
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    const auto mode = result["mode"].as<std::string>();
+    if (mode != "strong" && mode != "weak" && mode != "both") {
+        std::cerr << "Invalid mode: " << mode << std::endl;
+        return 1;
+    }
+    const auto threads = parse_threads(result["threads"].as<std::string>());
+    if (threads.empty() || threads.front() < 1) {
+        std::cerr << "Invalid thread list." << std::endl;
+        return 1;
+    }
+
+    Sweep sweep;
+    sweep.tesslocate = std::filesystem::absolute(result["tesslocate"].as<std::string>()).string();
+    sweep.gen = std::filesystem::absolute(result["gen"].as<std::string>()).string();
+    sweep.workdir = result["workdir"].as<std::string>();
+    sweep.distribution = result["distribution"].as<std::string>();
+    sweep.repetitions = std::max(1, result["repetitions"].as<int>());
+    std::filesystem::create_directories(sweep.workdir);
+    sweep.log = (sweep.workdir / "runs.log").string();
+
+    ojson report;
+    report["tesslocate"] = sweep.tesslocate;
+    report["environment"] = capture("'" + sweep.tesslocate + "' --version");
+    report["hardware_concurrency"] = std::thread::hardware_concurrency();
+    report["distribution"] = sweep.distribution;
+    report["repetitions"] = sweep.repetitions;
+
+    try {
+        std::cout << "Measuring startup cost." << std::endl;
+        auto startup = sweep.measure("startup", threads.back(), 0);
+        const double startup_seconds = startup["median_seconds"].get<double>();
+        report["startup_seconds"] = startup_seconds;
+
+        ojson results = ojson::array();
+        if (mode != "weak") {
+            const uint64_t rows = parse_rows(result["rows"].as<std::string>());
+            for (int t: threads) {
+                std::cout << "strong: threads=" << t << " rows=" << rows << std::endl;
+                results.push_back(sweep.measure("strong", t, rows));
+            }
+        }
+        if (mode != "strong") {
+            const uint64_t per_thread = parse_rows(result["rows-per-thread"].as<std::string>());
+            for (int t: threads) {
+                std::cout << "weak: threads=" << t << " rows=" << per_thread * t << std::endl;
+                results.push_back(sweep.measure("weak", t, per_thread * t));
+            }
+        }
+        summarise(results, startup_seconds);
+        report["results"] = results;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const auto path = result["report"].as<std::string>();
+    std::ofstream file(path);
+    file << report.dump(4) << std::endl;
+    std::cout << "Wrote report to " << path << "." << std::endl;
+    return 0;
+}
+
+// Standard normal quantile, by Newton iteration on erfc.
+static double normal_quantile(double p) {
+    double x = 0.0;
+    for (int i = 0; i < 50; ++i) {
+        const double cdf = 0.5 * std::erfc(-x / std::sqrt(2.0));
+        const double pdf = std::exp(-0.5 * x * x) / std::sqrt(2.0 * M_PI);
+        const double step = (cdf - p) / pdf;
+        x -= step;
+        if (std::abs(step) < 1e-12) break;
+    }
+    return x;
+}
+
+// Student t quantile for dof degrees of freedom: closed forms below three
+// degrees of freedom, Hill's expansion around the normal quantile above.
+static double t_quantile(double p, double dof) {
+    if (dof < 1.5) return std::tan(M_PI * (p - 0.5));
+    if (dof < 2.5) return (2 * p - 1) * std::sqrt(2.0 / (4 * p * (1 - p)));
+    const double z = normal_quantile(p);
+    const double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z, z9 = z7 * z * z;
+    return z + (z3 + z) / (4 * dof) + (5 * z5 + 16 * z3 + 3 * z) / (96 * dof * dof) +
+        (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * dof * dof * dof) +
+        (79 * z9 + 776 * z7 + 1482 * z5 - 1920 * z3 - 945 * z) / (92160 * dof * dof * dof * dof);
+}
+
+struct Sample {
+    double mean = 0;
+    double variance = 0;
+    size_t n = 0;
+};
+
+static Sample describe(const std::vector<double> &v) {
+    Sample s;
+    s.n = v.size();
+    for (double x: v) s.mean += x;
+    s.mean /= std::max<size_t>(1, s.n);
+    for (double x: v) s.variance += (x - s.mean) * (x - s.mean);
+    s.variance = s.n > 1 ? s.variance / (s.n - 1) : 0.0;
+    return s;
+}
+
+static int compare(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate-bench compare", "Compare a scaling report against a baseline");
+    options.add_options()
+        ("baseline", "baseline report", cxxopts::value<std::string>())
+        ("current", "report to check", cxxopts::value<std::string>())
+        ("threshold", "allowed slowdown in percent", cxxopts::value<double>()->default_value("5"))
+        ("rss-threshold", "allowed peak RSS growth in percent", cxxopts::value<double>()->default_value("10"))
+        ("confidence", "confidence level of the intervals", cxxopts::value<double>()->default_value("0.95"))
+        ("report", "optional path of a JSON comparison report", cxxopts::value<std::string>())
+        ("h,help", "print usage");
+    options.parse_positional({"baseline", "current"});
+    auto result = options.parse(argc, argv);
+    if (result.count("help") || !result.count("baseline") || !result.count("current")) {
+        std::cout << options.help() << std::endl;
+        return result.count("help") ? 0 : 1;
+    }
+
+    ojson baseline, current;
+    try {
+        std::ifstream(result["baseline"].as<std::string>()) >> baseline;
+        std::ifstream(result["current"].as<std::string>()) >> current;
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to read reports: " << e.what() << std::endl;
+        return 1;
+    }
+
+    const double threshold = result["threshold"].as<double>() / 100.0;
+    const double rss_threshold = result["rss-threshold"].as<double>() / 100.0;
+    const double confidence = result["confidence"].as<double>();
+
+    // Point out toolchain differences, which are usually the reason for the run.
+    const auto env_old = baseline.value("environment", std::vector<std::string>{});
+    const auto env_new = current.value("environment", std::vector<std::string>{});
+    for (const auto &line: env_old) {
+        if (std::find(env_new.begin(), env_new.end(), line) == env_new.end()) std::cout << "- " << line << "\n";
+    }
+    for (const auto &line: env_new) {
+        if (std::find(env_old.begin(), env_old.end(), line) == env_old.end()) std::cout << "+ " << line << "\n";
+    }
+
+    const ojson baseline_results = baseline.value("results", ojson::array());
+    const ojson current_results = current.value("results", ojson::array());
+    ojson rows = ojson::array();
+    bool failed = false;
+    for (const auto &base: baseline_results) {
+        const auto name = base["name"].get<std::string>();
+        ojson row;
+        row["name"] = name;
+
+        const ojson *match = nullptr;
+        for (const auto &r: current_results) {
+            if (r["name"] == name) match = &r;
+        }
+        if (!match) {
+            row["status"] = "missing";
+            failed = true;
+            rows.push_back(row);
+            continue;
+        }
+
+        const Sample a = describe(base["seconds"].get<std::vector<double> >());
+        const Sample b = describe((*match)["seconds"].get<std::vector<double> >());
+        const double diff = b.mean - a.mean;
+        const double va = a.variance / a.n, vb = b.variance / b.n;
+        const double se = std::sqrt(va + vb);
+        double half_width = 0.0;
+        if (se > 0) {
+            // Welch-Satterthwaite degrees of freedom.
+            double dof = (va + vb) * (va + vb) /
+                ((a.n > 1 ? va * va / (a.n - 1) : 0.0) + (b.n > 1 ? vb * vb / (b.n - 1) : 0.0));
+            dof = std::max(1.0, dof);
+            half_width = t_quantile(0.5 + confidence / 2.0, dof) * se;
+        }
+
+        const double delta = diff / a.mean;
+        const double low = (diff - half_width) / a.mean;
+        const double high = (diff + half_width) / a.mean;
+        const double rss_old = base.value("peak_rss_bytes", 0.0);
+        const double rss_new = match->value("peak_rss_bytes", 0.0);
+        const double rss_delta = rss_old > 0 ? rss_new / rss_old - 1.0 : 0.0;
+
+        std::string status = "pass";
+        if (low > threshold) {
+            status = "regression";
+        } else if (rss_delta > rss_threshold) {
+            status = "rss regression";
+        } else if (high < -threshold) {
+            status = "improvement";
+        } else if (high > threshold) {
+            // Cannot rule out a regression at this noise level.
+            status = "inconclusive";
+        }
+        failed = failed || status == "regression" || status == "rss regression";
+
+        row["status"] = status;
+        row["baseline_mean_seconds"] = a.mean;
+        row["current_mean_seconds"] = b.mean;
+        row["delta"] = delta;
+        row["delta_interval"] = {low, high};
+        row["rss_delta"] = rss_delta;
+        rows.push_back(row);
+    }
+
+    std::printf("%-44s %10s %22s %9s  %s\n", "benchmark", "delta", "interval", "rss", "status");
+    for (const auto &row: rows) {
+        if (row["status"] == "missing") {
+            std::printf("%-44s %10s %22s %9s  %s\n", row["name"].get<std::string>().c_str(), "-", "-", "-",
+                        "missing");
+            continue;
+        }
+        char interval[64];
+        std::snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", 100 * row["delta_interval"][0].get<double>(),
+                      100 * row["delta_interval"][1].get<double>());
+        std::printf("%-44s %+9.1f%% %22s %+8.1f%%  %s\n", row["name"].get<std::string>().c_str(),
+                    100 * row["delta"].get<double>(), interval, 100 * row["rss_delta"].get<double>(),
+                    row["status"].get<std::string>().c_str());
+    }
+    std::cout << (failed ? "FAIL" : "PASS") << std::endl;
+
+    if (result.count("report")) {
+        ojson report;
+        report["baseline"] = result["baseline"].as<std::string>();
+        report["current"] = result["current"].as<std::string>();
+        report["threshold"] = threshold;
+        report["confidence"] = confidence;
+        report["passed"] = !failed;
+        report["benchmarks"] = rows;
+        std::ofstream(result["report"].as<std::string>()) << report.dump(4) << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const std::string usage =
+        "usage: tesslocate-bench scale [options]\n"
+        "       tesslocate-bench compare <baseline.json> <current.json> [options]";
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+
+    const std::string command = argv[1];
+    if (command == "scale") return scale(argc - 1, argv + 1);
+    if (command == "compare") return compare(argc - 1, argv + 1);
+
+    std::cerr << "Unknown command: " << command << "\n" << usage << std::endl;
+    return 1;
+}
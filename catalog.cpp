@@ -0,0 +1,235 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+
+#include "external/csv.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+const char *row_status_reason(RowStatus status) {
+    switch (status) {
+        case RowStatus::ok:
+            return "ok";
+        case RowStatus::wrong_columns:
+            return "wrong number of columns";
+        case RowStatus::missing_id:
+            return "missing ID";
+        case RowStatus::bad_id:
+            return "non-numeric ID";
+        case RowStatus::bad_ra:
+            return "invalid ra";
+        case RowStatus::bad_dec:
+            return "invalid dec";
+    }
+    return "unknown";
+}
+
+std::optional<IdType> parse_id_type(const std::string &name) {
+    if (name == "auto") return IdType::automatic;
+    if (name == "string") return IdType::string;
+    if (name == "u64") return IdType::u64;
+    return std::nullopt;
+}
+
+bool parse_numeric_id(std::string_view text, uint64_t &id) {
+    if (text.empty() || (text.size() > 1 && text.front() == '0')) return false;
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), id);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+static int max_threads() {
+#ifdef USE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Parses a coordinate without throwing. Uses the CSV parser's own number
+// recognition, the same one get<double>() relies on.
+static bool parse_coordinate(std::string_view text, double &value) {
+    long double parsed = 0;
+    if (csv::internals::data_type(csv::string_view(text.data(), text.size()), &parsed) < csv::DataType::CSV_INT8) {
+        return false;
+    }
+    value = static_cast<double>(parsed);
+    return std::isfinite(value);
+}
+
+RowStatus parse_position(std::string_view ra_text, std::string_view dec_text, double &ra, double &dec) {
+    if (!parse_coordinate(ra_text, ra)) return RowStatus::bad_ra;
+    if (!parse_coordinate(dec_text, dec) || std::abs(dec) > 90) return RowStatus::bad_dec;
+    return RowStatus::ok;
+}
+
+struct Columns {
+    size_t count, id, ra, dec;
+};
+
+static RowStatus parse_row(const csv::CSVRow &row, const Columns &columns, Catalog &catalog, size_t i) {
+    if (row.size() != columns.count) return RowStatus::wrong_columns;
+    const auto id = row[columns.id].get_sv();
+    if (id.empty()) return RowStatus::missing_id;
+    if (catalog.numeric) {
+        if (!parse_numeric_id(std::string_view(id.data(), id.size()), catalog.numeric_ids[i])) return RowStatus::bad_id;
+    } else {
+        catalog.ids[i].assign(id.data(), id.size());
+    }
+    if (!catalog.has_positions) return RowStatus::ok;
+    const auto ra = row[columns.ra].get_sv(), dec = row[columns.dec].get_sv();
+    return parse_position(std::string_view(ra.data(), ra.size()), std::string_view(dec.data(), dec.size()),
+                          catalog.ra[i], catalog.dec[i]);
+}
+
+static std::string row_text(const csv::CSVRow &row) {
+    std::string res;
+    for (size_t i = 0; i < row.size(); ++i) {
+        if (i > 0) res += ',';
+        const auto field = row[i].get_sv();
+        res.append(field.data(), field.size());
+    }
+    return res;
+}
+
+static std::vector<csv::CSVRow> read_rows(csv::CSVReader &reader, Columns &columns) {
+    std::vector<csv::CSVRow> rows;
+    for (const auto &row: reader) {
+        rows.push_back(row);
+    }
+    columns.count = reader.get_col_names().size();
+    columns.id = reader.index_of("ID");
+    columns.ra = reader.index_of("ra");
+    columns.dec = reader.index_of("dec");
+    return rows;
+}
+
+// Whether every ID in the file is numeric. Rows too short to have an ID
+// don't count; they are rejected later either way.
+static bool all_ids_numeric(const std::vector<csv::CSVRow> &rows, size_t column) {
+    bool numeric = true;
+#ifdef USE_OPENMP
+#pragma omp parallel for reduction(&&:numeric)
+#endif
+    for (int64_t i = 0; i < static_cast<int64_t>(rows.size()); ++i) {
+        if (!numeric || rows[i].size() <= column) continue;
+        const auto id = rows[i][column].get_sv();
+        uint64_t value;
+        numeric = id.empty() || parse_numeric_id(std::string_view(id.data(), id.size()), value);
+    }
+    return numeric;
+}
+
+Catalog read_catalog(const std::string &path, InputBackend backend, InputBackend *used, IdType id_type) {
+    Catalog catalog;
+    Columns columns{};
+    std::vector<csv::CSVRow> rows;
+
+    std::unique_ptr<InputBuffer> buf;
+    if (backend != InputBackend::mmap) {
+        buf = open_uring_input(path);
+        if (!buf && backend == InputBackend::uring) {
+            throw std::runtime_error("io_uring input is not available");
+        }
+    }
+    if (buf) {
+        // The stream reader doesn't guess the delimiter, so sniff it from the
+        // head of the file the same way the mmap reader does.
+        auto guess = csv::guess_format(path, {',', '|', '\t', ';', '^'});
+        csv::CSVFormat format;
+        format.delimiter(guess.delim).header_row(guess.header_row).variable_columns(csv::VariableColumnPolicy::KEEP);
+        const InputBuffer *source = buf.get();
+        InputStream stream(std::move(buf));
+        csv::CSVReader reader(stream, format);
+        rows = read_rows(reader, columns);
+        if (source->error() != 0) {
+            throw std::runtime_error("Failed to read " + path + ": " + std::strerror(source->error()));
+        }
+        if (used) *used = InputBackend::uring;
+    } else {
+        // Keep rows with the wrong number of fields so they can be reported.
+        auto format = csv::CSVFormat::guess_csv();
+        format.variable_columns(csv::VariableColumnPolicy::KEEP);
+        csv::CSVReader reader(path, format);
+        rows = read_rows(reader, columns);
+        if (used) *used = InputBackend::mmap;
+    }
+
+    if (columns.id == csv::CSV_NOT_FOUND) {
+        throw std::runtime_error(path + " has no ID column");
+    }
+    catalog.has_positions = columns.ra != csv::CSV_NOT_FOUND && columns.dec != csv::CSV_NOT_FOUND;
+    catalog.numeric = id_type == IdType::u64 ||
+        (id_type == IdType::automatic && !rows.empty() && all_ids_numeric(rows, columns.id));
+    if (catalog.numeric) {
+        catalog.numeric_ids.resize(rows.size());
+    } else {
+        catalog.ids.resize(rows.size());
+    }
+    if (catalog.has_positions) {
+        catalog.ra.resize(rows.size());
+        catalog.dec.resize(rows.size());
+    }
+
+    // Bad rows are collected per thread; the parse itself never throws.
+    std::vector<std::vector<RejectedRow> > rejected(max_threads());
+    std::vector<char> ok(rows.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int64_t i = 0; i < static_cast<int64_t>(rows.size()); ++i) {
+#ifdef USE_OPENMP
+        auto &thread_rejects = rejected[omp_get_thread_num()];
+#else
+        auto &thread_rejects = rejected[0];
+#endif
+        const RowStatus status = parse_row(rows[i], columns, catalog, i);
+        ok[i] = status == RowStatus::ok;
+        if (!ok[i]) {
+            thread_rejects.push_back({static_cast<size_t>(i) + 1, status, row_text(rows[i])});
+        }
+    }
+
+    for (auto &thread_rejects: rejected) {
+        catalog.rejects.insert(catalog.rejects.end(), std::make_move_iterator(thread_rejects.begin()),
+                               std::make_move_iterator(thread_rejects.end()));
+    }
+    if (catalog.rejects.empty()) return catalog;
+    std::sort(catalog.rejects.begin(), catalog.rejects.end(),
+              [](const RejectedRow &a, const RejectedRow &b) { return a.row < b.row; });
+
+    // Compact the good rows in input order.
+    size_t kept = 0;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (!ok[i]) continue;
+        if (kept != i) {
+            if (catalog.numeric) {
+                catalog.numeric_ids[kept] = catalog.numeric_ids[i];
+            } else {
+                catalog.ids[kept] = std::move(catalog.ids[i]);
+            }
+            if (catalog.has_positions) {
+                catalog.ra[kept] = catalog.ra[i];
+                catalog.dec[kept] = catalog.dec[i];
+            }
+        }
+        ++kept;
+    }
+    if (catalog.numeric) {
+        catalog.numeric_ids.resize(kept);
+    } else {
+        catalog.ids.resize(kept);
+    }
+    if (catalog.has_positions) {
+        catalog.ra.resize(kept);
+        catalog.dec.resize(kept);
+    }
+    return catalog;
+}
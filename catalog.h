@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <s2/s2point.h>
+
+#include "input.h"
+
+// Outcome of parsing one input row.
+enum class RowStatus {
+    ok,
+    wrong_columns, // the row has a different number of fields than the header
+    missing_id,
+    bad_id,        // not an unsigned 64-bit integer, with --id-type u64
+    bad_ra,        // not a finite number
+    bad_dec,       // not a number in [-90, 90]
+};
+
+const char *row_status_reason(RowStatus status);
+
+// A row left out of the catalog because it couldn't be parsed.
+struct RejectedRow {
+    size_t row;       // 1-based record number after the header
+    RowStatus status;
+    std::string text; // the row's fields joined with commas
+};
+
+// How IDs are carried through a run.
+enum class IdType {
+    automatic, // u64 when every ID is a plain unsigned integer, string otherwise
+    string,
+    u64,       // rows whose ID isn't an unsigned integer are rejected
+};
+
+std::optional<IdType> parse_id_type(const std::string &name);
+
+// Whether text is an unsigned integer that to_chars would write back
+// unchanged, i.e. digits only and no leading zeros.
+bool parse_numeric_id(std::string_view text, uint64_t &id);
+
+// Parses ra and dec the way read_catalog() does, without throwing: ra has to
+// be a finite number and dec a number in [-90, 90]. Returns ok, bad_ra or
+// bad_dec.
+RowStatus parse_position(std::string_view ra_text, std::string_view dec_text, double &ra, double &dec);
+
+// The columns of a compiled catalog (see compiled_catalog.h), viewed in place
+// in the mapped file, which stays mapped for as long as this is alive.
+struct CompiledColumns {
+    std::shared_ptr<const void> mapping;
+    size_t count = 0;
+    const uint64_t *input_rows = nullptr; // each row's position among the accepted rows of the source
+    const double *xyz = nullptr;          // unit vectors, three doubles per row
+    const uint64_t *numeric_ids = nullptr; // set for numeric IDs, otherwise id_offsets and id_text are
+    const uint64_t *id_offsets = nullptr;  // count + 1 offsets into id_text
+    const char *id_text = nullptr;
+
+    S2Point point(size_t i) const {
+        return S2Point(this->xyz[3 * i], this->xyz[3 * i + 1], this->xyz[3 * i + 2]);
+    }
+
+    std::string_view id(size_t i) const {
+        return {this->id_text + this->id_offsets[i], this->id_offsets[i + 1] - this->id_offsets[i]};
+    }
+};
+
+// An input catalog in column form, in input order unless compiled is set.
+struct Catalog {
+    // IDs are kept in exactly one of these. Numeric IDs avoid a string per
+    // row and are only formatted when the results are written.
+    bool numeric = false;
+    std::vector<std::string> ids;
+    std::vector<uint64_t> numeric_ids;
+
+    std::vector<double> ra;
+    std::vector<double> dec;
+
+    // False for ID-only input, whose positions still have to be resolved.
+    bool has_positions = true;
+
+    // Set for compiled catalogs, whose rows are in Hilbert order. Their IDs,
+    // points and input positions are read from here; ids and numeric_ids
+    // stay empty.
+    std::shared_ptr<const CompiledColumns> compiled;
+
+    // Malformed rows, in input order. They are not part of ids, ra and dec.
+    std::vector<RejectedRow> rejects;
+
+    size_t size() const {
+        if (this->compiled) return this->compiled->count;
+        return this->numeric ? this->numeric_ids.size() : this->ids.size();
+    }
+
+    // The ID of row i as text.
+    std::string id(size_t i) const {
+        if (this->compiled) {
+            return this->numeric ? std::to_string(this->compiled->numeric_ids[i]) : std::string(this->compiled->id(i));
+        }
+        return this->numeric ? std::to_string(this->numeric_ids[i]) : this->ids[i];
+    }
+};
+
+// Reads a CSV with columns ID, ra, dec, or with only an ID column. Sets *used
+// to the backend that actually read the file. Malformed rows don't stop the
+// read; they are collected in Catalog::rejects instead. Throws only when the
+// file can't be read or has no ID column.
+Catalog read_catalog(const std::string &path, InputBackend backend = InputBackend::automatic,
+                     InputBackend *used = nullptr, IdType id_type = IdType::automatic);
@@ -0,0 +1,179 @@
+#include "compiled_catalog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <s2/s2cell_id.h>
+#include "locator.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+static constexpr char kMagic[8] = "TESSCAT";
+static constexpr uint64_t kNumericIds = 1;
+
+bool is_compiled_catalog(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[8] = {};
+    file.read(magic, sizeof(magic));
+    return file && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+template<typename T>
+static void write_column(std::ofstream &file, const std::vector<T> &column) {
+    file.write(reinterpret_cast<const char *>(column.data()), static_cast<std::streamsize>(sizeof(T) * column.size()));
+}
+
+void compile_catalog(const Catalog &catalog, const std::string &out_path) {
+    if (!catalog.has_positions) {
+        throw std::runtime_error("Only catalogs with ra and dec columns can be compiled");
+    }
+    const int64_t n = catalog.size();
+
+    std::vector<S2Point> points(n);
+    std::vector<uint64_t> cells(n);
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int64_t i = 0; i < n; ++i) {
+        points[i] = radec_point(catalog.ra[i], catalog.dec[i]);
+        cells[i] = S2CellId(points[i]).id();
+    }
+
+    std::vector<uint64_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) { return cells[a] < cells[b]; });
+
+    std::vector<uint64_t> sorted_cells(n), numeric_ids, id_offsets;
+    std::vector<double> xyz(3 * n), ra(n), dec(n);
+    std::string ids;
+    if (catalog.numeric) {
+        numeric_ids.resize(n);
+    } else {
+        id_offsets.resize(n + 1);
+    }
+    for (int64_t k = 0; k < n; ++k) {
+        const uint64_t i = order[k];
+        sorted_cells[k] = cells[i];
+        xyz[3 * k] = points[i].x();
+        xyz[3 * k + 1] = points[i].y();
+        xyz[3 * k + 2] = points[i].z();
+        ra[k] = catalog.ra[i];
+        dec[k] = catalog.dec[i];
+        if (catalog.numeric) {
+            numeric_ids[k] = catalog.numeric_ids[i];
+        } else {
+            id_offsets[k] = ids.size();
+            ids += catalog.ids[i];
+        }
+    }
+    if (!catalog.numeric) id_offsets[n] = ids.size();
+
+    std::filesystem::path out(out_path);
+    if (out.has_parent_path()) std::filesystem::create_directories(out.parent_path());
+    const std::string tmp = out_path + ".tmp";
+    std::ofstream file(tmp, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + tmp);
+    }
+    const uint64_t header[3] = {static_cast<uint64_t>(n), catalog.numeric ? kNumericIds : 0, ids.size()};
+    file.write(kMagic, sizeof(kMagic));
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    write_column(file, sorted_cells);
+    write_column(file, order);
+    write_column(file, xyz);
+    write_column(file, ra);
+    write_column(file, dec);
+    write_column(file, numeric_ids);
+    write_column(file, id_offsets);
+    file.write(ids.data(), static_cast<std::streamsize>(ids.size()));
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write " + tmp);
+    }
+    std::filesystem::rename(tmp, out_path);
+}
+
+Catalog read_compiled_catalog(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open compiled catalog: " + path);
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    const size_t map_size = st.st_size;
+    if (map_size < 32) {
+        close(fd);
+        throw std::runtime_error("Invalid compiled catalog: " + path);
+    }
+    void *map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Failed to map compiled catalog: " + path);
+    }
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    std::shared_ptr<const void> mapping(map, [map_size](const void *m) { munmap(const_cast<void *>(m), map_size); });
+
+    const auto *base = static_cast<const char *>(map);
+    uint64_t n, flags, id_bytes;
+    std::memcpy(&n, base + 8, sizeof(n));
+    std::memcpy(&flags, base + 16, sizeof(flags));
+    std::memcpy(&id_bytes, base + 24, sizeof(id_bytes));
+    // Fixed columns take 56 bytes a row, the IDs 8 more plus the offsets'
+    // extra entry and the text for string IDs.
+    const bool numeric = flags & kNumericIds;
+    const size_t fixed = numeric ? 32 : 40;
+    if (std::memcmp(base, kMagic, sizeof(kMagic)) != 0 || map_size < fixed || n > (map_size - fixed) / 64 ||
+        id_bytes != map_size - fixed - 64 * n || (numeric && id_bytes != 0)) {
+        throw std::runtime_error("Invalid compiled catalog: " + path);
+    }
+    const auto *ra = reinterpret_cast<const double *>(base + 32 + 40 * n);
+    const auto *dec = reinterpret_cast<const double *>(base + 32 + 48 * n);
+
+    auto columns = std::make_shared<CompiledColumns>();
+    columns->count = n;
+    columns->input_rows = reinterpret_cast<const uint64_t *>(base + 32 + 8 * n);
+    columns->xyz = reinterpret_cast<const double *>(base + 32 + 16 * n);
+    if (numeric) {
+        columns->numeric_ids = reinterpret_cast<const uint64_t *>(base + 32 + 56 * n);
+    } else {
+        columns->id_offsets = reinterpret_cast<const uint64_t *>(base + 32 + 56 * n);
+        columns->id_text = base + 32 + 8 * (8 * n + 1);
+    }
+    columns->mapping = std::move(mapping);
+
+    // The columns are read without bounds checks later, so a corrupt file
+    // has to be caught here: offsets run from 0 to id_bytes without going
+    // back, and every input position names a row.
+    bool valid = numeric || (columns->id_offsets[0] == 0 && columns->id_offsets[n] == id_bytes);
+#ifdef USE_OPENMP
+#pragma omp parallel for reduction(&&:valid)
+#endif
+    for (int64_t k = 0; k < static_cast<int64_t>(n); ++k) {
+        valid = valid && columns->input_rows[k] < n &&
+            (numeric || columns->id_offsets[k] <= columns->id_offsets[k + 1]);
+    }
+    if (!valid) {
+        throw std::runtime_error("Invalid compiled catalog: " + path);
+    }
+
+    // The queries walk the rows in order, but keep ra and dec as plain columns
+    // for the covering and the planner's sample.
+    Catalog catalog;
+    catalog.numeric = numeric;
+    catalog.ra.assign(ra, ra + n);
+    catalog.dec.assign(dec, dec + n);
+    catalog.compiled = std::move(columns);
+    return catalog;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include "catalog.h"
+
+// A catalog compiled ahead of time with `tesslocate catalog compile`, so runs
+// against many footprint versions skip parsing the CSV and converting
+// coordinates. Rows are sorted by leaf S2CellId, i.e. in Hilbert order, which
+// keeps neighbouring queries close together in the index.
+//
+// File layout (native endianness):
+//   char     magic[8]            "TESSCAT"
+//   uint64_t count
+//   uint64_t flags               bit 0: IDs are numeric
+//   uint64_t id_bytes            0 with numeric IDs
+//   uint64_t cell_ids[count]     ascending
+//   uint64_t input_rows[count]   position of each row among the source's accepted rows
+//   double   points[count][3]    unit vectors
+//   double   ra[count]
+//   double   dec[count]
+// then, with numeric IDs,
+//   uint64_t numeric_ids[count]
+// or otherwise
+//   uint64_t id_offsets[count + 1] into ids
+//   char     ids[id_bytes]
+
+// Whether path starts with the compiled catalog magic.
+bool is_compiled_catalog(const std::string &path);
+
+// Sorts a catalog with positions into Hilbert order and writes it. Numeric
+// IDs are kept as integers.
+void compile_catalog(const Catalog &catalog, const std::string &out_path);
+
+// Maps a compiled catalog into a Catalog in Hilbert order, numeric if its IDs
+// are. IDs, points and input positions are viewed in place through
+// Catalog::compiled; only ra and dec are copied, in bulk.
+Catalog read_compiled_catalog(const std::string &path);
@@ -0,0 +1,297 @@
+#include "cutout.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "external/csv.h"
+#include "fits.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+// A quiet NaN as a big-endian float, the layout of FITS data.
+static constexpr char kNan[4] = {0x7f, static_cast<char>(0xc0), 0, 0};
+
+using GroupKey = std::tuple<int, int, int>; // sector, camera, CCD
+
+struct CutoutTarget {
+    std::string ID;
+    double ra;
+    double dec;
+    size_t frames = 0;
+    std::string path; // output path without extension
+};
+
+// The FFIs of one sector, camera and CCD and the targets on it.
+struct FfiGroup {
+    std::vector<std::string> ffis;
+    std::vector<uint32_t> targets;
+    std::vector<size_t> first_frame; // where each target's frames from this group start in its cube
+};
+
+// The sector, camera and CCD in a MAST FFI file name, e.g.
+// tess2018206192942-s0001-1-1-0120-s_ffic.fits.
+static bool parse_ffi_name(const std::string &name, GroupKey &key) {
+    static const std::regex pattern("-s(\\d{4})-(\\d)-(\\d)-");
+    std::smatch match;
+    if (!std::regex_search(name, match, pattern)) return false;
+    key = {std::stoi(match[1]), std::stoi(match[2]), std::stoi(match[3])};
+    return true;
+}
+
+// A file name for an ID: anything but letters, digits, '.', '-' and '_'
+// becomes '_'.
+static std::string file_stem(const std::string &ID) {
+    std::string res = ID;
+    for (auto &c: res) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-' && c != '_') c = '_';
+    }
+    if (res.empty() || res[0] == '.') res.insert(0, "_");
+    return res;
+}
+
+static void fill_nan(char *out, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) std::memcpy(out + 4 * i, kNan, 4);
+}
+
+static void write_at(const std::string &path, const char *data, size_t size, size_t offset) {
+    const int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = pwrite(fd, data + done, size - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            throw std::runtime_error("Failed to write " + path + ": " + std::strerror(errno));
+        }
+        done += n;
+    }
+    close(fd);
+}
+
+// Cuts every target of a batch out of one FFI. out holds the batch's cubes,
+// ffi_count frames per target, and xy each frame's target position.
+static void cut_ffi(const std::string &path, size_t frame, size_t ffi_count, const std::vector<CutoutTarget> &targets,
+                    const uint32_t *batch, size_t count, int size, char *out, double *xy) {
+    const FitsImage image(path);
+    if (image.bitpix != -32) {
+        throw std::runtime_error(path + " has BITPIX " + std::to_string(image.bitpix) + ", not -32");
+    }
+    const TanWcs wcs = TanWcs::from_header(image.header);
+    const size_t pixels = static_cast<size_t>(size) * size;
+    const int half = size / 2;
+
+    for (size_t k = 0; k < count; ++k) {
+        const auto &t = targets[batch[k]];
+        char *cube = out + (k * ffi_count + frame) * pixels * 4;
+        double x, y;
+        if (!wcs.world_to_pixel(t.ra, t.dec, x, y) || std::abs(x) > 1e9 || std::abs(y) > 1e9) {
+            fill_nan(cube, pixels);
+            continue;
+        }
+        xy[2 * (k * ffi_count + frame)] = x;
+        xy[2 * (k * ffi_count + frame) + 1] = y;
+
+        // Pixel centres sit on whole FITS coordinates, starting at 1.
+        const int64_t left = std::llround(x) - 1 - half;
+        const int64_t bottom = std::llround(y) - 1 - half;
+        const int64_t lo = std::clamp<int64_t>(-left, 0, size);
+        const int64_t hi = std::clamp<int64_t>(image.width - left, lo, size);
+        for (int r = 0; r < size; ++r) {
+            char *dst = cube + static_cast<size_t>(r) * size * 4;
+            const int64_t row = bottom + r;
+            if (row < 0 || row >= image.height) {
+                fill_nan(dst, size);
+                continue;
+            }
+            fill_nan(dst, lo);
+            std::memcpy(dst + lo * 4, image.row(row) + (left + lo) * 4, (hi - lo) * 4);
+            fill_nan(dst + hi * 4, size - hi);
+        }
+    }
+}
+
+CutoutSummary extract_cutouts(const std::string &results_path, const std::string &ffi_dir,
+                              const std::string &out_dir, const CutoutOptions &options) {
+    if (options.size < 1 || options.size % 2 == 0) {
+        throw std::runtime_error("Cutout size must be odd");
+    }
+    const size_t pixels = static_cast<size_t>(options.size) * options.size;
+    const size_t frame_bytes = pixels * 4;
+    CutoutSummary summary;
+
+    // Targets and the sector, camera and CCD groups they fall on.
+    std::vector<CutoutTarget> targets;
+    std::unordered_map<std::string, uint32_t> target_index;
+    std::map<GroupKey, FfiGroup> groups;
+    csv::CSVReader reader(results_path);
+    for (const char *column: {"ID", "ra", "dec", "sector", "camera", "ccd"}) {
+        if (reader.index_of(column) == csv::CSV_NOT_FOUND) {
+            throw std::runtime_error(results_path + " has no " + column + " column");
+        }
+    }
+    for (auto &row: reader) {
+        auto ID = row["ID"].get<std::string>();
+        auto [it, added] = target_index.emplace(ID, static_cast<uint32_t>(targets.size()));
+        if (added) {
+            targets.push_back({std::move(ID), row["ra"].get<double>(), row["dec"].get<double>()});
+        }
+        const GroupKey key{row["sector"].get<int>(), row["camera"].get<int>(), row["ccd"].get<int>()};
+        groups[key].targets.push_back(it->second);
+    }
+
+    for (const auto &entry: std::filesystem::recursive_directory_iterator(ffi_dir)) {
+        GroupKey key;
+        if (!entry.is_regular_file() || entry.path().extension() != ".fits" ||
+            !parse_ffi_name(entry.path().filename().string(), key)) {
+            continue;
+        }
+        auto it = groups.find(key);
+        if (it != groups.end()) it->second.ffis.push_back(entry.path().string());
+    }
+
+    // Lay out each target's cube: its groups in order, each group's FFIs by
+    // file name, which starts with the observation time.
+    for (auto &[key, group]: groups) {
+        std::sort(group.ffis.begin(), group.ffis.end(), [](const std::string &a, const std::string &b) {
+            return std::filesystem::path(a).filename() < std::filesystem::path(b).filename();
+        });
+        std::sort(group.targets.begin(), group.targets.end());
+        group.targets.erase(std::unique(group.targets.begin(), group.targets.end()), group.targets.end());
+        group.first_frame.resize(group.targets.size());
+        for (size_t k = 0; k < group.targets.size(); ++k) {
+            auto &t = targets[group.targets[k]];
+            group.first_frame[k] = t.frames;
+            t.frames += group.ffis.size();
+        }
+        summary.ffis += group.ffis.size();
+    }
+
+    // Create every cube at its final size. The header always fits in one block.
+    std::filesystem::create_directories(out_dir);
+    for (auto &t: targets) {
+        if (t.frames == 0) continue;
+        t.path = (std::filesystem::path(out_dir) / file_stem(t.ID)).string();
+        char ra[32], dec[32];
+        std::snprintf(ra, sizeof(ra), "%.8f", t.ra);
+        std::snprintf(dec, sizeof(dec), "%.8f", t.dec);
+        const std::string header = fits_header({
+            fits_card("SIMPLE", "T"),
+            fits_card("BITPIX", "-32"),
+            fits_card("NAXIS", "3"),
+            fits_card("NAXIS1", std::to_string(options.size)),
+            fits_card("NAXIS2", std::to_string(options.size)),
+            fits_card("NAXIS3", std::to_string(t.frames), "frames, listed in the .frames.csv file"),
+            fits_card("OBJECT", fits_string(t.ID.substr(0, 60))),
+            fits_card("RA_OBJ", ra, "degrees"),
+            fits_card("DEC_OBJ", dec, "degrees"),
+        });
+        std::ofstream cube(t.path + ".fits", std::ios::binary);
+        cube.write(header.data(), header.size());
+        cube.close();
+        std::ofstream frames(t.path + ".frames.csv");
+        frames << "frame,ffi,x,y\n";
+        frames.close();
+        if (!cube || !frames) {
+            throw std::runtime_error("Failed to create " + t.path + ".fits");
+        }
+        const size_t data = t.frames * frame_bytes;
+        std::filesystem::resize_file(t.path + ".fits", kFitsBlock + (data + kFitsBlock - 1) / kFitsBlock * kFitsBlock);
+        ++summary.targets;
+        summary.frames += t.frames;
+    }
+
+    // One pass over a group's FFIs cuts out as many of its targets as fit in
+    // memory; large groups take several passes. An FFI that fails does so in
+    // every pass but is reported once.
+    std::set<std::string> failed_ffis;
+    for (const auto &[key, group]: groups) {
+        const size_t ffi_count = group.ffis.size();
+        if (ffi_count == 0 || group.targets.empty()) continue;
+        const size_t batch = std::max<size_t>(1, options.memory / (ffi_count * frame_bytes));
+        for (size_t first = 0; first < group.targets.size(); first += batch) {
+            const size_t count = std::min(batch, group.targets.size() - first);
+            std::vector<char> cubes(count * ffi_count * frame_bytes);
+            std::vector<double> xy(count * ffi_count * 2, std::nan(""));
+            std::vector<std::string> errors(ffi_count);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for (int64_t f = 0; f < static_cast<int64_t>(ffi_count); ++f) {
+                try {
+                    cut_ffi(group.ffis[f], f, ffi_count, targets, group.targets.data() + first, count, options.size,
+                            cubes.data(), xy.data());
+                } catch (const std::exception &e) {
+                    errors[f] = e.what();
+                    for (size_t k = 0; k < count; ++k) {
+                        fill_nan(cubes.data() + (k * ffi_count + f) * frame_bytes, pixels);
+                    }
+                }
+            }
+            for (size_t f = 0; f < ffi_count; ++f) {
+                if (errors[f].empty() || !failed_ffis.insert(group.ffis[f]).second) continue;
+                std::cerr << "Skipped FFI: " << errors[f] << std::endl;
+            }
+
+            std::vector<std::string> write_errors(count);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for (int64_t k = 0; k < static_cast<int64_t>(count); ++k) {
+                const auto &t = targets[group.targets[first + k]];
+                const size_t first_frame = group.first_frame[first + k];
+                try {
+                    write_at(t.path + ".fits", cubes.data() + k * ffi_count * frame_bytes,
+                             ffi_count * frame_bytes, kFitsBlock + first_frame * frame_bytes);
+                } catch (const std::exception &e) {
+                    write_errors[k] = e.what();
+                    continue;
+                }
+                std::string lines;
+                char buf[64];
+                for (size_t f = 0; f < ffi_count; ++f) {
+                    const double x = xy[2 * (k * ffi_count + f)], y = xy[2 * (k * ffi_count + f) + 1];
+                    lines += std::to_string(first_frame + f) + "," +
+                        std::filesystem::path(group.ffis[f]).filename().string() + ",";
+                    if (!std::isnan(x)) {
+                        lines.append(buf, std::snprintf(buf, sizeof(buf), "%.3f,%.3f", x, y));
+                    } else {
+                        lines += ",";
+                    }
+                    lines += "\n";
+                }
+                std::ofstream frames(t.path + ".frames.csv", std::ios::app);
+                frames << lines;
+            }
+            for (const auto &error: write_errors) {
+                if (!error.empty()) throw std::runtime_error(error);
+            }
+            ++summary.passes;
+        }
+    }
+    summary.failed = failed_ffis.size();
+    if (summary.failed > 0) {
+        std::cerr << summary.failed << " FFIs couldn't be read; their frames are NaN." << std::endl;
+    }
+    return summary;
+}
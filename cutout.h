@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Cutouts from a local mirror of TESS FFIs, driven by a tesslocate CSV result
+// file. Targets are grouped by sector, camera and CCD as in the results, and
+// each FFI is mapped once per pass to cut out every target in its group,
+// instead of once per target.
+//
+// For each target with at least one FFI, out_dir gets:
+//   <ID>.fits        a BITPIX -32 cube of size x size x frames, one frame per
+//                    FFI ordered by sector, camera, CCD and file name
+//   <ID>.frames.csv  frame,ffi,x,y: the source FFI of each frame and the
+//                    target's 1-based pixel position in it; the cutout is
+//                    centred on the nearest pixel
+// Pixels outside the FFI are NaN. FFIs are found by their MAST file names,
+// which contain -s<sector>-<camera>-<ccd>-, and must be uncompressed.
+struct CutoutOptions {
+    int size = 11;                     // cutout side in pixels, odd
+    size_t memory = size_t(1) << 30;   // bytes of cutouts held before writing
+};
+
+struct CutoutSummary {
+    size_t targets = 0; // with at least one frame
+    size_t ffis = 0;
+    size_t frames = 0;
+    size_t passes = 0;  // FFI group passes; more than one per group when memory runs out
+    size_t failed = 0;  // FFIs that couldn't be read; their frames are NaN
+};
+
+CutoutSummary extract_cutouts(const std::string &results_path, const std::string &ffi_dir,
+                              const std::string &out_dir, const CutoutOptions &options);
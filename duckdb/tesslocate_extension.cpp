@@ -0,0 +1,251 @@
+// Loadable DuckDB extension exposing the locator to SQL:
+//
+//     LOAD 'tesslocate.duckdb_extension';
+//     SELECT id, tess_ffis(ra, dec) FROM targets;
+//     SELECT obs_id, count(*) FROM tess_ffi_targets((SELECT id, ra, dec FROM targets)) GROUP BY obs_id;
+//
+// Both functions work on DuckDB's vectors a chunk at a time on whichever
+// threads DuckDB schedules them. The footprint index is built once per
+// database and kept in its object cache.
+#define DUCKDB_EXTENSION_MAIN
+
+#include "duckdb.hpp"
+#include "duckdb/common/types/data_chunk.hpp"
+#include "duckdb/function/scalar_function.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/main/extension/extension_loader.hpp"
+#include "duckdb/storage/object_cache.hpp"
+
+#include "locator.h"
+
+namespace duckdb {
+    // The index plus each footprint's obs_id parts, shared by every query.
+    class TesslocateIndex : public ObjectCacheEntry {
+    public:
+        IndexedPolygons index;
+        vector<string> obs_ids;
+        vector<int32_t> sectors, cameras, ccds;
+
+        TesslocateIndex() : index(IndexedPolygons::load()) {
+            this->index.force_build();
+            for (size_t h = 0; h < this->index.size(); ++h) {
+                const auto &obs = this->index.name(static_cast<ObservationHandle>(h));
+                this->obs_ids.push_back(obs);
+                this->sectors.push_back(std::stoi(obs.substr(6, 4)));
+                this->cameras.push_back(obs[11] - '0');
+                this->ccds.push_back(obs[13] - '0');
+            }
+        }
+
+        static string ObjectType() {
+            return "tesslocate_index";
+        }
+
+        string GetObjectType() override {
+            return ObjectType();
+        }
+
+        optional_idx GetEstimatedCacheMemory() const override {
+            return optional_idx();
+        }
+    };
+
+    static shared_ptr<TesslocateIndex> GetIndex(ClientContext &context) {
+        return ObjectCache::GetObjectCache(context).GetOrCreate<TesslocateIndex>(TesslocateIndex::ObjectType());
+    }
+
+    static LogicalType FfiStruct() {
+        child_list_t<LogicalType> fields;
+        fields.emplace_back("obs_id", LogicalType::VARCHAR);
+        fields.emplace_back("sector", LogicalType::INTEGER);
+        fields.emplace_back("camera", LogicalType::INTEGER);
+        fields.emplace_back("ccd", LogicalType::INTEGER);
+        return LogicalType::STRUCT(std::move(fields));
+    }
+
+    // Writes the FFI fields of handles into fields[0..3] (obs_id, sector,
+    // camera, ccd) at rows offset, offset + 1, ...
+    static void WriteFfis(const TesslocateIndex &ffis, const vector<ObservationHandle> &handles, Vector *fields[4],
+                          idx_t offset) {
+        auto *obs_ids = FlatVector::GetData<string_t>(*fields[0]);
+        auto *sectors = FlatVector::GetData<int32_t>(*fields[1]);
+        auto *cameras = FlatVector::GetData<int32_t>(*fields[2]);
+        auto *ccds = FlatVector::GetData<int32_t>(*fields[3]);
+        for (idx_t i = 0; i < handles.size(); ++i) {
+            const auto h = handles[i];
+            obs_ids[offset + i] = StringVector::AddString(*fields[0], ffis.obs_ids[h]);
+            sectors[offset + i] = ffis.sectors[h];
+            cameras[offset + i] = ffis.cameras[h];
+            ccds[offset + i] = ffis.ccds[h];
+        }
+    }
+
+    // tess_ffis(ra DOUBLE, dec DOUBLE) -> LIST(STRUCT(obs_id, sector, camera, ccd))
+    static void TessFfisFunction(DataChunk &args, ExpressionState &state, Vector &result) {
+        const auto ffis = GetIndex(state.GetContext());
+        const idx_t count = args.size();
+
+        UnifiedVectorFormat ra_data, dec_data;
+        args.data[0].ToUnifiedFormat(count, ra_data);
+        args.data[1].ToUnifiedFormat(count, dec_data);
+        const auto *ra = UnifiedVectorFormat::GetData<double>(ra_data);
+        const auto *dec = UnifiedVectorFormat::GetData<double>(dec_data);
+
+        result.SetVectorType(VectorType::FLAT_VECTOR);
+        auto *entries = FlatVector::GetData<list_entry_t>(result);
+        auto &validity = FlatVector::Validity(result);
+
+        // Search the whole chunk first so the child vector is sized once.
+        vector<vector<ObservationHandle> > hits(count);
+        idx_t total = 0;
+        for (idx_t row = 0; row < count; ++row) {
+            const auto ra_idx = ra_data.sel->get_index(row);
+            const auto dec_idx = dec_data.sel->get_index(row);
+            if (!ra_data.validity.RowIsValid(ra_idx) || !dec_data.validity.RowIsValid(dec_idx)) {
+                validity.SetInvalid(row);
+                continue;
+            }
+            ffis->index.search(radec_point(ra[ra_idx], dec[dec_idx]), Engine::index, hits[row]);
+            entries[row] = list_entry_t(total, hits[row].size());
+            total += hits[row].size();
+        }
+
+        ListVector::Reserve(result, total);
+        auto &child = ListVector::GetEntry(result);
+        auto &entries_of = StructVector::GetEntries(child);
+        Vector *fields[4] = {entries_of[0].get(), entries_of[1].get(), entries_of[2].get(), entries_of[3].get()};
+        for (idx_t row = 0; row < count; ++row) {
+            if (validity.RowIsValid(row)) WriteFfis(*ffis, hits[row], fields, entries[row].offset);
+        }
+        ListVector::SetListSize(result, total);
+        if (args.AllConstant()) result.SetVectorType(VectorType::CONSTANT_VECTOR);
+    }
+
+    // tess_ffi_targets(TABLE(id, ra, dec)): one row per target and FFI with
+    // the FFI's obs_id, sector, camera and ccd followed by the input columns,
+    // i.e. the inverted per-FFI view when grouped by obs_id.
+    struct TessFfiTargetsState : public LocalTableFunctionState {
+        shared_ptr<TesslocateIndex> ffis;
+        vector<vector<ObservationHandle> > hits;
+        bool searched = false;
+        idx_t row = 0; // next input row to emit
+        idx_t hit = 0; // next hit of that row
+    };
+
+    static unique_ptr<FunctionData> TessFfiTargetsBind(ClientContext &context, TableFunctionBindInput &input,
+                                                       vector<LogicalType> &return_types, vector<string> &names) {
+        if (input.input_table_types.size() != 3) {
+            throw BinderException("tess_ffi_targets expects a table with columns id, ra, dec");
+        }
+        // Checked here rather than failing in the cast halfway through a query.
+        for (idx_t c = 1; c < 3; ++c) {
+            if (!input.input_table_types[c].IsNumeric()) {
+                throw BinderException("tess_ffi_targets needs numeric ra and dec columns, got %s for %s",
+                                      input.input_table_types[c].ToString(), input.input_table_names[c]);
+            }
+        }
+        names = {"obs_id", "sector", "camera", "ccd"};
+        return_types = {LogicalType::VARCHAR, LogicalType::INTEGER, LogicalType::INTEGER, LogicalType::INTEGER};
+        for (idx_t c = 0; c < 3; ++c) {
+            names.push_back(input.input_table_names[c]);
+            return_types.push_back(input.input_table_types[c]);
+        }
+        return make_uniq<TableFunctionData>();
+    }
+
+    static unique_ptr<LocalTableFunctionState> TessFfiTargetsInit(ExecutionContext &context,
+                                                                  TableFunctionInitInput &input,
+                                                                  GlobalTableFunctionState *global) {
+        auto state = make_uniq<TessFfiTargetsState>();
+        state->ffis = GetIndex(context.client);
+        return std::move(state);
+    }
+
+    static OperatorResultType TessFfiTargetsFunction(ExecutionContext &context, TableFunctionInput &data,
+                                                     DataChunk &input, DataChunk &output) {
+        auto &state = data.local_state->Cast<TessFfiTargetsState>();
+        const idx_t count = input.size();
+
+        if (!state.searched) {
+            Vector ra(LogicalType::DOUBLE, count), dec(LogicalType::DOUBLE, count);
+            VectorOperations::Cast(context.client, input.data[1], ra, count);
+            VectorOperations::Cast(context.client, input.data[2], dec, count);
+            UnifiedVectorFormat ra_data, dec_data;
+            ra.ToUnifiedFormat(count, ra_data);
+            dec.ToUnifiedFormat(count, dec_data);
+
+            state.hits.assign(count, {});
+            for (idx_t row = 0; row < count; ++row) {
+                const auto ra_idx = ra_data.sel->get_index(row);
+                const auto dec_idx = dec_data.sel->get_index(row);
+                if (!ra_data.validity.RowIsValid(ra_idx) || !dec_data.validity.RowIsValid(dec_idx)) continue;
+                state.ffis->index.search(radec_point(UnifiedVectorFormat::GetData<double>(ra_data)[ra_idx],
+                                                     UnifiedVectorFormat::GetData<double>(dec_data)[dec_idx]),
+                                         Engine::index, state.hits[row]);
+            }
+            state.searched = true;
+            state.row = 0;
+            state.hit = 0;
+        }
+
+        // Fill up to one vector of output; the input columns are passed
+        // through by slicing them with the rows each output row came from.
+        SelectionVector sel(STANDARD_VECTOR_SIZE);
+        vector<ObservationHandle> handles;
+        idx_t out = 0;
+        while (out < STANDARD_VECTOR_SIZE && state.row < count) {
+            const auto &row_hits = state.hits[state.row];
+            if (state.hit >= row_hits.size()) {
+                ++state.row;
+                state.hit = 0;
+                continue;
+            }
+            handles.push_back(row_hits[state.hit++]);
+            sel.set_index(out++, state.row);
+        }
+
+        Vector *fields[4] = {&output.data[0], &output.data[1], &output.data[2], &output.data[3]};
+        WriteFfis(*state.ffis, handles, fields, 0);
+        for (idx_t c = 0; c < 3; ++c) {
+            output.data[4 + c].Slice(input.data[c], sel, out);
+        }
+        output.SetCardinality(out);
+
+        if (state.row < count) return OperatorResultType::HAVE_MORE_OUTPUT;
+        state.searched = false;
+        return OperatorResultType::NEED_MORE_INPUT;
+    }
+
+    static void LoadInternal(ExtensionLoader &loader) {
+        ScalarFunction tess_ffis("tess_ffis", {LogicalType::DOUBLE, LogicalType::DOUBLE},
+                                 LogicalType::LIST(FfiStruct()), TessFfisFunction);
+        tess_ffis.null_handling = FunctionNullHandling::SPECIAL_HANDLING;
+        loader.RegisterFunction(tess_ffis);
+
+        TableFunction targets("tess_ffi_targets", {LogicalType::TABLE}, nullptr, TessFfiTargetsBind, nullptr,
+                              TessFfiTargetsInit);
+        targets.in_out_function = TessFfiTargetsFunction;
+        loader.RegisterFunction(targets);
+    }
+
+    class TesslocateExtension : public Extension {
+    public:
+        void Load(ExtensionLoader &loader) override {
+            LoadInternal(loader);
+        }
+
+        std::string Name() override {
+            return "tesslocate";
+        }
+
+        std::string Version() const override {
+            return TESSLOCATE_VERSION;
+        }
+    };
+}
+
+extern "C" {
+DUCKDB_CPP_EXTENSION_ENTRY(tesslocate, loader) {
+    duckdb::LoadInternal(loader);
+}
+}
@@ -0,0 +1,264 @@
+#include "estimate.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catalog.h"
+#include "external/csv.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+    uint64_t splitmix64(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    // A read-only file sampled at arbitrary offsets.
+    class SampledFile {
+        int fd;
+
+    public:
+        size_t size = 0;
+
+        explicit SampledFile(const std::string &path) {
+            this->fd = open(path.c_str(), O_RDONLY);
+            if (this->fd < 0) {
+                throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+            }
+            struct stat st{};
+            fstat(this->fd, &st);
+            this->size = st.st_size;
+        }
+
+        ~SampledFile() {
+            close(this->fd);
+        }
+
+        SampledFile(const SampledFile &) = delete;
+        SampledFile &operator=(const SampledFile &) = delete;
+
+        // The line starting at begin, without its line ending.
+        std::string line_at(size_t begin) const {
+            std::string line;
+            char buf[4096];
+            for (size_t offset = begin; offset < this->size;) {
+                const ssize_t n = pread(this->fd, buf, sizeof(buf), static_cast<off_t>(offset));
+                if (n <= 0) break;
+                const char *end = static_cast<const char *>(memchr(buf, '\n', n));
+                line.append(buf, end ? end - buf : n);
+                if (end) break;
+                offset += n;
+            }
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return line;
+        }
+
+        // Start of the first line beginning at or after offset, or size if none does.
+        size_t next_line(size_t offset) const {
+            if (offset == 0) return 0;
+            char buf[4096];
+            // The line starts right at offset if the byte before it ends a line.
+            for (size_t pos = offset - 1; pos < this->size;) {
+                const ssize_t n = pread(this->fd, buf, sizeof(buf), static_cast<off_t>(pos));
+                if (n <= 0) break;
+                const char *end = static_cast<const char *>(memchr(buf, '\n', n));
+                if (end) return pos + (end - buf) + 1;
+                pos += n;
+            }
+            return this->size;
+        }
+    };
+
+    struct Layout {
+        char delimiter;
+        size_t count, id, ra, dec;
+    };
+
+    // Splits one line into fields the way the CSV parser does: a field may be
+    // quoted, and a quoted field may hold the delimiter and doubled quotes.
+    std::vector<std::string> split(const std::string &line, char delimiter) {
+        std::vector<std::string> res(1);
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); ++i) {
+            const char c = line[i];
+            if (quoted) {
+                if (c != '"') {
+                    res.back() += c;
+                } else if (i + 1 < line.size() && line[i + 1] == '"') {
+                    res.back() += '"';
+                    ++i;
+                } else {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == delimiter) {
+                res.emplace_back();
+            } else {
+                res.back() += c;
+            }
+        }
+        return res;
+    }
+
+    // The delimiter is guessed the same way read_catalog() guesses it.
+    Layout parse_header(const std::string &path, const std::string &header) {
+        Layout layout{};
+        layout.delimiter = csv::guess_format(path, {',', '|', '\t', ';', '^'}).delim;
+        const auto names = split(header, layout.delimiter);
+        layout.count = names.size();
+        auto column = [&](const char *name) {
+            const auto it = std::find(names.begin(), names.end(), name);
+            if (it == names.end()) {
+                throw std::runtime_error(std::string("Estimation needs an ") + name + " column");
+            }
+            return static_cast<size_t>(it - names.begin());
+        };
+        layout.id = column("ID");
+        layout.ra = column("ra");
+        layout.dec = column("dec");
+        return layout;
+    }
+
+    // Checks a sampled row like read_catalog() checks rows, so the estimate
+    // covers the same rows a full run accepts.
+    RowStatus parse_sampled_row(const std::string &line, const Layout &layout, double &ra, double &dec) {
+        const auto fields = split(line, layout.delimiter);
+        if (fields.size() != layout.count) return RowStatus::wrong_columns;
+        if (fields[layout.id].empty()) return RowStatus::missing_id;
+        return parse_position(fields[layout.ra], fields[layout.dec], ra, dec);
+    }
+
+    // Wilson score interval at 95%.
+    Proportion proportion(size_t hits, size_t n) {
+        Proportion res;
+        if (n == 0) return res;
+        constexpr double z = 1.959963984540054;
+        const double p = static_cast<double>(hits) / n;
+        const double denom = 1 + z * z / n;
+        const double center = (p + z * z / (2.0 * n)) / denom;
+        const double half = z * std::sqrt(p * (1 - p) / n + z * z / (4.0 * n * n)) / denom;
+        res.value = p;
+        res.low = std::max(0.0, center - half);
+        res.high = std::min(1.0, center + half);
+        return res;
+    }
+
+    double half_width(const Proportion &p) {
+        return std::max(p.value - p.low, p.high - p.value);
+    }
+}
+
+Estimate estimate_catalog(const std::string &path, const IndexedPolygons &index, Engine engine,
+                          const EstimateOptions &options) {
+    SampledFile file(path);
+    const std::string header = file.line_at(0);
+    const Layout layout = parse_header(path, header);
+    const size_t data_start = file.next_line(header.size() + 1);
+    if (data_start >= file.size) {
+        throw std::runtime_error(path + " has no rows to sample");
+    }
+
+    std::vector<int> sector_of(index.size());
+    for (size_t h = 0; h < index.size(); ++h) {
+        sector_of[h] = std::stoi(index.name(static_cast<ObservationHandle>(h)).substr(6, 4));
+    }
+
+    // Running totals over all rounds.
+    size_t sampled = 0, parsed = 0, line_bytes = 0;
+    size_t observed = 0;
+    std::map<int, size_t> per_sector;
+    std::vector<size_t> per_multiplicity;
+    Estimate res;
+
+    size_t round_size = options.initial_sample;
+    for (uint64_t round = 0; sampled < options.max_sample; ++round) {
+        round_size = std::min(round_size, options.max_sample - sampled);
+        const double stratum = static_cast<double>(file.size - data_start) / round_size;
+
+        std::vector<std::vector<int> > sectors(round_size);
+        std::vector<size_t> lengths(round_size);
+        std::vector<char> ok(round_size);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+        for (int64_t s = 0; s < static_cast<int64_t>(round_size); ++s) {
+            const uint64_t r = splitmix64(options.seed ^ splitmix64(round << 40 ^ s));
+            const double u = (r >> 11) * 0x1.0p-53;
+            const size_t offset = data_start + static_cast<size_t>((s + u) * stratum);
+            const size_t begin = file.next_line(offset);
+            if (begin >= file.size) continue;
+            const std::string line = file.line_at(begin);
+            lengths[s] = line.size() + 1;
+            double ra, dec;
+            if (parse_sampled_row(line, layout, ra, dec) != RowStatus::ok) continue;
+            ok[s] = true;
+
+            std::vector<ObservationHandle> handles;
+            index.search(radec_point(ra, dec), engine, handles);
+            std::set<int> distinct;
+            for (const auto &h: handles) distinct.insert(sector_of[h]);
+            sectors[s].assign(distinct.begin(), distinct.end());
+        }
+
+        for (size_t s = 0; s < round_size; ++s) {
+            line_bytes += lengths[s];
+            if (!ok[s]) continue;
+            ++parsed;
+            if (!sectors[s].empty()) ++observed;
+            for (int sector: sectors[s]) ++per_sector[sector];
+            if (per_multiplicity.size() < sectors[s].size()) per_multiplicity.resize(sectors[s].size());
+            // per_multiplicity[k - 1] counts rows on at least k sectors.
+            for (size_t k = 0; k < sectors[s].size(); ++k) ++per_multiplicity[k];
+        }
+        sampled += round_size;
+
+        res.sample_rows = parsed;
+        res.rows = line_bytes ? (file.size - data_start) / (static_cast<double>(line_bytes) / sampled) : 0;
+        res.observed = proportion(observed, parsed);
+        res.sectors.clear();
+        for (const auto &[sector, hits]: per_sector) res.sectors[sector] = proportion(hits, parsed);
+        res.at_least.clear();
+        for (size_t hits: per_multiplicity) res.at_least.push_back(proportion(hits, parsed));
+
+        double worst = half_width(res.observed);
+        for (const auto &[sector, p]: res.sectors) worst = std::max(worst, half_width(p));
+        for (const auto &p: res.at_least) worst = std::max(worst, half_width(p));
+        if (parsed > 0 && worst <= options.precision) break;
+        round_size = sampled;
+    }
+    return res;
+}
+
+void print_estimate(std::ostream &out, const Estimate &estimate) {
+    auto row = [&](const std::string &label, const Proportion &p) {
+        out << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(4)
+            << std::setw(8) << p.value << "  [" << p.low << ", " << p.high << "]  ~"
+            << std::setprecision(0) << p.value * estimate.rows << " rows\n";
+    };
+
+    out << "Sampled " << estimate.sample_rows << " of about " << std::fixed << std::setprecision(0)
+        << estimate.rows << " rows. Fractions with 95% confidence intervals:\n";
+    row("observed", estimate.observed);
+    // at_least[0] is the same as observed.
+    for (size_t k = 1; k < estimate.at_least.size(); ++k) {
+        row(">= " + std::to_string(k + 1) + " sectors", estimate.at_least[k]);
+    }
+    for (const auto &[sector, p]: estimate.sectors) {
+        row("sector " + std::to_string(sector), p);
+    }
+    out << std::defaultfloat;
+}
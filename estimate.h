@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "locator.h"
+
+// A fraction of the catalog with its 95% confidence interval.
+struct Proportion {
+    double value = 0;
+    double low = 0;
+    double high = 0;
+};
+
+// Answers to "roughly how many of my targets..." questions from a sample of
+// the input rather than a full run.
+struct Estimate {
+    size_t sample_rows = 0;
+    double rows = 0;                      // estimated number of rows in the input
+    Proportion observed;                  // on at least one FFI
+    std::map<int, Proportion> sectors;    // observed in each sector
+    std::vector<Proportion> at_least;     // [k - 1]: observed in at least k distinct sectors
+};
+
+struct EstimateOptions {
+    double precision = 0.01;    // stop once every interval is at most this wide on either side
+    size_t initial_sample = 4096;
+    size_t max_sample = 1000000;
+    uint64_t seed = 1;
+};
+
+// Samples rows of a CSV with ID, ra and dec columns without parsing the whole
+// file: the bytes after the header are cut into equal strata and one row is
+// taken from a random offset in each, namely the first row that starts at or
+// after it. Each round draws a new stratified sample twice the size of
+// everything drawn so far, until the requested precision or max_sample is
+// reached. Rows that follow long rows are slightly more likely to be picked,
+// which doesn't matter unless row length correlates with position.
+Estimate estimate_catalog(const std::string &path, const IndexedPolygons &index, Engine engine,
+                          const EstimateOptions &options);
+
+void print_estimate(std::ostream &out, const Estimate &estimate);
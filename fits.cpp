@@ -0,0 +1,241 @@
+#include "fits.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr size_t kCard = 80;
+
+static std::string trim(const std::string &text) {
+    const auto first = text.find_first_not_of(' ');
+    if (first == std::string::npos) return "";
+    return text.substr(first, text.find_last_not_of(' ') - first + 1);
+}
+
+FitsHeader FitsHeader::parse(const char *data, size_t size, size_t *length) {
+    FitsHeader res;
+    for (size_t pos = 0; pos + kCard <= size; pos += kCard) {
+        const std::string card(data + pos, kCard);
+        const std::string key = trim(card.substr(0, 8));
+        if (key == "END") {
+            if (length) *length = (pos + kCard + kFitsBlock - 1) / kFitsBlock * kFitsBlock;
+            return res;
+        }
+        if (card.compare(8, 2, "= ") != 0) continue; // COMMENT, HISTORY, blank
+
+        // Strings run to the closing quote, with '' standing for a quote;
+        // anything else runs to the comment.
+        std::string value;
+        size_t i = 10;
+        while (i < kCard && card[i] == ' ') ++i;
+        if (i < kCard && card[i] == '\'') {
+            value += '\'';
+            for (++i; i < kCard; ++i) {
+                if (card[i] == '\'' && i + 1 < kCard && card[i + 1] == '\'') {
+                    value += '\'';
+                    ++i;
+                } else if (card[i] == '\'') {
+                    break;
+                } else {
+                    value += card[i];
+                }
+            }
+        } else {
+            value = trim(card.substr(i, card.find('/', i) - i));
+        }
+        res.values.emplace(key, std::move(value));
+    }
+    throw std::runtime_error("FITS header has no END card");
+}
+
+double FitsHeader::number(const std::string &key, double fallback) const {
+    auto it = this->values.find(key);
+    if (it == this->values.end()) return fallback;
+    std::string text = it->second;
+    std::replace(text.begin(), text.end(), 'D', 'E'); // Fortran-style exponents
+    char *end = nullptr;
+    const double value = std::strtod(text.c_str(), &end);
+    return end == text.c_str() ? fallback : value;
+}
+
+std::string FitsHeader::text(const std::string &key) const {
+    auto it = this->values.find(key);
+    if (it == this->values.end() || it->second.empty() || it->second[0] != '\'') return "";
+    std::string res = it->second.substr(1);
+    res.erase(res.find_last_not_of(' ') + 1);
+    return res;
+}
+
+TanWcs TanWcs::from_header(const FitsHeader &header) {
+    if (header.text("CTYPE1").rfind("RA---TAN", 0) != 0 || header.text("CTYPE2").rfind("DEC--TAN", 0) != 0) {
+        throw std::runtime_error("FITS header has no RA---TAN/DEC--TAN WCS");
+    }
+    TanWcs res;
+    for (int i = 0; i < 2; ++i) {
+        res.crval[i] = header.number("CRVAL" + std::to_string(i + 1));
+        res.crpix[i] = header.number("CRPIX" + std::to_string(i + 1));
+    }
+
+    // CD matrix, or PC scaled by CDELT.
+    double cd[2][2];
+    const bool has_cd = header.has("CD1_1") || header.has("CD1_2") || header.has("CD2_1") || header.has("CD2_2");
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            const std::string suffix = std::to_string(i + 1) + "_" + std::to_string(j + 1);
+            if (has_cd) {
+                cd[i][j] = header.number("CD" + suffix);
+            } else {
+                cd[i][j] = header.number("PC" + suffix, i == j ? 1 : 0) *
+                    header.number("CDELT" + std::to_string(i + 1), 1);
+            }
+        }
+    }
+    const double det = cd[0][0] * cd[1][1] - cd[0][1] * cd[1][0];
+    if (det == 0) {
+        throw std::runtime_error("FITS WCS matrix is singular");
+    }
+    res.cd_inverse[0][0] = cd[1][1] / det;
+    res.cd_inverse[0][1] = -cd[0][1] / det;
+    res.cd_inverse[1][0] = -cd[1][0] / det;
+    res.cd_inverse[1][1] = cd[0][0] / det;
+
+    res.ap_order = static_cast<int>(header.number("AP_ORDER"));
+    if (res.ap_order > 0) {
+        const int n = res.ap_order + 1;
+        res.ap.assign(n * n, 0);
+        res.bp.assign(n * n, 0);
+        for (int p = 0; p < n; ++p) {
+            for (int q = 0; p + q < n; ++q) {
+                const std::string suffix = std::to_string(p) + "_" + std::to_string(q);
+                res.ap[p * n + q] = header.number("AP_" + suffix);
+                res.bp[p * n + q] = header.number("BP_" + suffix);
+            }
+        }
+    }
+    return res;
+}
+
+bool TanWcs::world_to_pixel(double ra, double dec, double &x, double &y) const {
+    constexpr double kDeg = M_PI / 180;
+    const double d = dec * kDeg, d0 = this->crval[1] * kDeg;
+    const double da = (ra - this->crval[0]) * kDeg;
+    const double cos_c = std::sin(d0) * std::sin(d) + std::cos(d0) * std::cos(d) * std::cos(da);
+    if (cos_c <= 0) return false;
+
+    // Gnomonic projection to intermediate world coordinates, in degrees.
+    const double xi = std::cos(d) * std::sin(da) / cos_c / kDeg;
+    const double eta = (std::cos(d0) * std::sin(d) - std::sin(d0) * std::cos(d) * std::cos(da)) / cos_c / kDeg;
+    const double u = this->cd_inverse[0][0] * xi + this->cd_inverse[0][1] * eta;
+    const double v = this->cd_inverse[1][0] * xi + this->cd_inverse[1][1] * eta;
+
+    double du = 0, dv = 0;
+    if (this->ap_order > 0) {
+        const int n = this->ap_order + 1;
+        double up = 1;
+        for (int p = 0; p < n; ++p) {
+            double vq = 1;
+            for (int q = 0; p + q < n; ++q) {
+                du += this->ap[p * n + q] * up * vq;
+                dv += this->bp[p * n + q] * up * vq;
+                vq *= v;
+            }
+            up *= u;
+        }
+    }
+    x = u + du + this->crpix[0];
+    y = v + dv + this->crpix[1];
+    return true;
+}
+
+FitsImage::FitsImage(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    this->map_size = st.st_size;
+    if (this->map_size == 0) {
+        close(fd);
+        throw std::runtime_error("Empty FITS file: " + path);
+    }
+    this->map = mmap(nullptr, this->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->map == MAP_FAILED) {
+        this->map = nullptr;
+        throw std::runtime_error("Failed to map " + path);
+    }
+
+    // Walk the HDUs to the first image with two axes. TESS FFIs keep theirs
+    // in the first extension, behind an empty primary HDU.
+    const auto *base = static_cast<const char *>(this->map);
+    size_t pos = 0;
+    while (pos < this->map_size) {
+        size_t length = 0;
+        FitsHeader hdu = FitsHeader::parse(base + pos, this->map_size - pos, &length);
+        const int bitpix = static_cast<int>(hdu.number("BITPIX"));
+        const int naxis = static_cast<int>(hdu.number("NAXIS"));
+        size_t elements = naxis > 0 ? 1 : 0;
+        for (int i = 1; i <= naxis; ++i) elements *= static_cast<size_t>(hdu.number("NAXIS" + std::to_string(i)));
+        const size_t data_size = std::abs(bitpix) / 8 * static_cast<size_t>(hdu.number("GCOUNT", 1)) *
+            (static_cast<size_t>(hdu.number("PCOUNT", 0)) + elements);
+
+        const bool image = !hdu.has("XTENSION") || hdu.text("XTENSION") == "IMAGE";
+        if (image && naxis == 2 && elements > 0) {
+            if (pos + length + data_size > this->map_size) break;
+            this->bitpix = bitpix;
+            this->width = static_cast<int64_t>(hdu.number("NAXIS1"));
+            this->height = static_cast<int64_t>(hdu.number("NAXIS2"));
+            this->pixels = base + pos + length;
+            this->header = std::move(hdu);
+            madvise(this->map, this->map_size, MADV_RANDOM);
+            return;
+        }
+        pos += length + (data_size + kFitsBlock - 1) / kFitsBlock * kFitsBlock;
+    }
+    munmap(this->map, this->map_size);
+    this->map = nullptr;
+    throw std::runtime_error("No 2-D image in " + path);
+}
+
+FitsImage::~FitsImage() {
+    if (this->map) munmap(this->map, this->map_size);
+}
+
+std::string fits_string(const std::string &text) {
+    std::string res = "'";
+    for (char c: text) {
+        res += c;
+        if (c == '\'') res += '\'';
+    }
+    // Fixed-format strings are at least eight characters inside the quotes.
+    if (res.size() < 9) res.resize(9, ' ');
+    return res + "'";
+}
+
+std::string fits_card(const std::string &key, const std::string &value, const std::string &comment) {
+    std::string res = key;
+    res.resize(8, ' ');
+    res += "= ";
+    // Non-string values are right-aligned to column 30.
+    if (value.empty() || value[0] != '\'') res.append(value.size() < 20 ? 20 - value.size() : 0, ' ');
+    res += value;
+    if (!comment.empty()) res += " / " + comment;
+    res.resize(kCard, ' ');
+    return res;
+}
+
+std::string fits_header(const std::vector<std::string> &cards) {
+    std::string res;
+    for (const auto &card: cards) res += card;
+    std::string end = "END";
+    end.resize(kCard, ' ');
+    res += end;
+    res.resize((res.size() + kFitsBlock - 1) / kFitsBlock * kFitsBlock, ' ');
+    return res;
+}
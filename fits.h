@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Just enough FITS to read TESS FFIs and write cutout cubes: header cards,
+// the first 2-D image HDU of a file, and TAN(-SIP) world to pixel conversion.
+
+// The keyword values of one header, as written in the file.
+class FitsHeader {
+    std::unordered_map<std::string, std::string> values;
+
+public:
+    // Parses 80-character cards up to END. Sets *length to the header's size
+    // in bytes, padded to the FITS block size.
+    static FitsHeader parse(const char *data, size_t size, size_t *length);
+
+    bool has(const std::string &key) const {
+        return this->values.count(key) > 0;
+    }
+
+    double number(const std::string &key, double fallback = 0) const;
+
+    // A string value without its quotes and trailing blanks.
+    std::string text(const std::string &key) const;
+};
+
+// The world to pixel part of a TAN or TAN-SIP WCS.
+struct TanWcs {
+    double crval[2] = {0, 0}; // degrees
+    double crpix[2] = {0, 0};
+    double cd_inverse[2][2] = {{1, 0}, {0, 1}};
+
+    // Inverse SIP polynomials: ap[p * (ap_order + 1) + q] is AP_p_q.
+    int ap_order = 0;
+    std::vector<double> ap, bp;
+
+    // Throws if the header has no celestial TAN WCS.
+    static TanWcs from_header(const FitsHeader &header);
+
+    // 1-based FITS pixel coordinates of ra, dec. Returns false for positions
+    // on the far side of the projection.
+    bool world_to_pixel(double ra, double dec, double &x, double &y) const;
+};
+
+// The first 2-D image HDU of a FITS file, memory mapped. Pixels are left in
+// the file's big-endian layout.
+class FitsImage {
+    void *map = nullptr;
+    size_t map_size = 0;
+    const char *pixels = nullptr;
+
+public:
+    FitsHeader header;
+    int bitpix = 0;
+    int64_t width = 0;  // NAXIS1
+    int64_t height = 0; // NAXIS2
+
+    explicit FitsImage(const std::string &path);
+    ~FitsImage();
+    FitsImage(const FitsImage &) = delete;
+    FitsImage &operator=(const FitsImage &) = delete;
+
+    // Start of 0-based image row y.
+    const char *row(int64_t y) const {
+        return this->pixels + y * this->width * (std::abs(this->bitpix) / 8);
+    }
+};
+
+// FITS header blocks are padded to this size, and so is data.
+constexpr size_t kFitsBlock = 2880;
+
+// One header card. Values are written verbatim, except strings, which
+// fits_string() quotes.
+std::string fits_card(const std::string &key, const std::string &value, const std::string &comment = "");
+std::string fits_string(const std::string &text);
+
+// Cards followed by END, padded to a whole block.
+std::string fits_header(const std::vector<std::string> &cards);
@@ -0,0 +1,97 @@
+#include "index_handle.h"
+
+#include <algorithm>
+#include <iterator>
+
+// A reader's pin: shares ownership of the version and, when the reader
+// drops it, lets the handle know so a retired version can be reaped.
+struct IndexHandle::Pin {
+    const IndexHandle *handle;
+    std::shared_ptr<const IndexedPolygons> index;
+
+    void operator()(const IndexedPolygons *) {
+        // Give up ownership first, so the reaper sees the version unpinned.
+        this->index.reset();
+        this->handle->released();
+    }
+};
+
+IndexHandle::~IndexHandle() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->reap.notify_one();
+    if (this->reaper.joinable()) this->reaper.join();
+}
+
+std::shared_ptr<const IndexedPolygons> IndexHandle::acquire() const {
+    std::shared_ptr<const IndexedPolygons> index;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        index = this->current;
+    }
+    const IndexedPolygons *raw = index.get();
+    return std::shared_ptr<const IndexedPolygons>(raw, Pin{this, std::move(index)});
+}
+
+void IndexHandle::released() const {
+    if (this->retired_count.load(std::memory_order_acquire) == 0) return;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->reap_pending = true;
+    }
+    this->reap.notify_one();
+}
+
+void IndexHandle::publish(std::shared_ptr<const IndexedPolygons> index) {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->retired.push_back(std::move(this->current));
+        this->retired_count.store(this->retired.size(), std::memory_order_release);
+        this->current = std::move(index);
+        this->reap_pending = true;
+        if (!this->reaper.joinable()) {
+            this->reaper = std::thread([this] { this->reap_retired(); });
+        }
+    }
+    this->published.fetch_add(1, std::memory_order_acq_rel);
+    this->reap.notify_one();
+}
+
+void IndexHandle::reap_retired() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    while (true) {
+        this->reap.wait(guard, [this] { return this->stopping || this->reap_pending; });
+        if (this->stopping) return;
+        this->reap_pending = false;
+
+        // A retired version whose only owner is this list can't be pinned
+        // again, so it is freed here, outside the lock.
+        auto it = std::partition(this->retired.begin(), this->retired.end(),
+                                 [](const auto &index) { return index.use_count() > 1; });
+        std::vector<std::shared_ptr<const IndexedPolygons> > unused(std::make_move_iterator(it),
+                                                                    std::make_move_iterator(this->retired.end()));
+        this->retired.erase(it, this->retired.end());
+        this->retired_count.store(this->retired.size(), std::memory_order_release);
+        guard.unlock();
+        unused.clear();
+        guard.lock();
+    }
+}
+
+void IndexHandle::rebuild(const json &footprints, bool with_cell_table) {
+    auto index = std::make_shared<IndexedPolygons>(
+        IndexedPolygons::build(footprints, IndexedPolygons::tuned_options(footprints)));
+    index->force_build();
+    if (with_cell_table) {
+        index->build_cell_table(kCellTableLevel);
+    }
+    this->publish(std::move(index));
+}
+
+std::future<void> IndexHandle::rebuild_async(bool with_cell_table) {
+    return std::async(std::launch::async, [this, with_cell_table] {
+        this->rebuild(load_footprints(), with_cell_table);
+    });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "locator.h"
+
+// A swappable footprint index for long-lived processes (services, watchers,
+// interactive sessions). Readers pin the current version with acquire() for
+// the length of a query or batch; publish() swaps in a new version without
+// waiting for them. Queries already running finish on the version they
+// pinned. A replaced version is freed as soon as its last reader drops it,
+// by a reaper thread the handle starts on its first publish(), so no query
+// pays for tearing down an index.
+class IndexHandle {
+    // Guards current, retired and stopping. Held only to copy or swap a
+    // pointer.
+    mutable std::mutex lock;
+    std::shared_ptr<const IndexedPolygons> current;
+    // Replaced versions, possibly still pinned by readers.
+    std::vector<std::shared_ptr<const IndexedPolygons> > retired;
+    std::atomic<size_t> retired_count{0};
+    std::atomic<uint64_t> published{1};
+
+    mutable std::condition_variable reap;
+    mutable bool reap_pending = false;
+    bool stopping = false;
+    std::thread reaper;
+
+    // The deleter of acquire()'s pointers; calls released() when one is dropped.
+    struct Pin;
+    void released() const;
+    void reap_retired();
+
+public:
+    explicit IndexHandle(std::shared_ptr<const IndexedPolygons> index) : current(std::move(index)) {}
+    ~IndexHandle();
+
+    IndexHandle(const IndexHandle &) = delete;
+    IndexHandle &operator=(const IndexHandle &) = delete;
+
+    // The current version. Keep the pointer for as long as its results are
+    // used, but not past the handle's own lifetime.
+    std::shared_ptr<const IndexedPolygons> acquire() const;
+
+    // Makes index the version that later acquire() calls see. The version it
+    // replaces is freed once no reader pins it.
+    void publish(std::shared_ptr<const IndexedPolygons> index);
+
+    // Number of versions published so far, starting at 1.
+    uint64_t version() const {
+        return this->published.load(std::memory_order_acquire);
+    }
+
+    // Builds a new version from footprints, ready for every engine (the shape
+    // index and, if with_cell_table, the Engine::cells table), then publishes it.
+    void rebuild(const json &footprints, bool with_cell_table = false);
+
+    // rebuild() on a background thread from the footprint cache, downloading
+    // it first if it is missing.
+    std::future<void> rebuild_async(bool with_cell_table = false);
+};
@@ -0,0 +1,197 @@
+#include "input.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+
+const char *input_backend_name(InputBackend backend) {
+    switch (backend) {
+        case InputBackend::automatic:
+            return "auto";
+        case InputBackend::uring:
+            return "uring";
+        case InputBackend::mmap:
+            return "mmap";
+    }
+    return "unknown";
+}
+
+std::optional<InputBackend> parse_input_backend(const std::string &name) {
+    for (InputBackend backend: {InputBackend::automatic, InputBackend::uring, InputBackend::mmap}) {
+        if (name == input_backend_name(backend)) return backend;
+    }
+    return std::nullopt;
+}
+
+#ifdef USE_IO_URING
+// Keeps kDepth reads of kBlock bytes in flight into a ring of aligned buffers
+// and hands the buffers to the reader in file order. Uses O_DIRECT where the
+// filesystem supports it so the reads bypass the page cache.
+class UringStreamBuf : public InputBuffer {
+    static constexpr size_t kBlock = 4 << 20;
+    static constexpr unsigned kDepth = 8;
+    static constexpr size_t kAlign = 4096;
+
+    struct Slot {
+        char *data = nullptr;
+        size_t offset = 0;
+        int result = 0;
+        bool queued = false;  // holds a block the reader hasn't consumed yet
+        bool pending = false; // read still in flight
+    };
+
+    io_uring ring{};
+    int fd = -1;
+    int buffered_fd = -1; // for the rare short read that O_DIRECT can't resume
+    size_t file_size = 0;
+    size_t next_offset = 0;
+    size_t next_slot = 0; // slot holding the next block in file order
+    std::vector<Slot> slots;
+    bool ring_ready = false;
+
+    void submit(Slot &slot) {
+        slot.offset = this->next_offset;
+        slot.queued = true;
+        slot.pending = true;
+        this->next_offset += kBlock;
+        io_uring_sqe *sqe = io_uring_get_sqe(&this->ring);
+        io_uring_prep_read(sqe, this->fd, slot.data, kBlock, slot.offset);
+        io_uring_sqe_set_data(sqe, &slot);
+        io_uring_submit(&this->ring);
+    }
+
+    int_type fail(int error) {
+        this->read_errno = error;
+        this->setg(nullptr, nullptr, nullptr);
+        return traits_type::eof();
+    }
+
+protected:
+    int_type underflow() override {
+        if (this->read_errno != 0) return traits_type::eof();
+        if (this->gptr() < this->egptr()) return traits_type::to_int_type(*this->gptr());
+
+        // The buffer just consumed is free again; queue the next block into it.
+        if (this->eback()) {
+            Slot &consumed = this->slots[(this->next_slot + kDepth - 1) % kDepth];
+            this->setg(nullptr, nullptr, nullptr);
+            if (this->next_offset < this->file_size) this->submit(consumed);
+        }
+
+        Slot &slot = this->slots[this->next_slot];
+        if (!slot.queued) return traits_type::eof();
+
+        while (slot.pending) {
+            io_uring_cqe *cqe;
+            const int waited = io_uring_wait_cqe(&this->ring, &cqe);
+            if (waited < 0) return this->fail(-waited);
+            auto *done = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+            done->result = cqe->res;
+            done->pending = false;
+            io_uring_cqe_seen(&this->ring, cqe);
+        }
+        if (slot.result < 0) return this->fail(-slot.result);
+
+        size_t length = slot.result;
+        const size_t expected = std::min(kBlock, this->file_size - std::min(this->file_size, slot.offset));
+        while (length < expected) {
+            const ssize_t n = pread(this->buffered_fd, slot.data + length, expected - length, slot.offset + length);
+            if (n < 0 && errno == EINTR) continue;
+            // A file that shrank while being read ends early, which is an error too.
+            if (n <= 0) return this->fail(n < 0 ? errno : EIO);
+            length += n;
+        }
+        slot.queued = false;
+        if (length == 0) return traits_type::eof();
+
+        this->setg(slot.data, slot.data, slot.data + length);
+        this->next_slot = (this->next_slot + 1) % kDepth;
+        return traits_type::to_int_type(*this->gptr());
+    }
+
+public:
+    // Leaves ready() false if the kernel won't set up a ring, so the caller can fall back.
+    explicit UringStreamBuf(const std::string &path) {
+        this->buffered_fd = open(path.c_str(), O_RDONLY);
+        if (this->buffered_fd < 0) {
+            throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+        }
+#ifdef O_DIRECT
+        this->fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+#endif
+        if (this->fd < 0) this->fd = this->buffered_fd;
+
+        struct stat st{};
+        fstat(this->buffered_fd, &st);
+        this->file_size = st.st_size;
+
+        if (io_uring_queue_init(kDepth, &this->ring, 0) < 0) {
+            this->release();
+            return;
+        }
+        this->ring_ready = true;
+
+        this->slots.resize(kDepth);
+        for (auto &slot: this->slots) {
+            void *data = nullptr;
+            if (posix_memalign(&data, kAlign, kBlock) != 0) {
+                this->release();
+                throw std::bad_alloc();
+            }
+            slot.data = static_cast<char *>(data);
+        }
+        for (auto &slot: this->slots) {
+            if (this->next_offset >= this->file_size) break;
+            this->submit(slot);
+        }
+    }
+
+    ~UringStreamBuf() override {
+        this->release();
+    }
+
+    bool ready() const {
+        return this->ring_ready;
+    }
+
+private:
+    void release() {
+        if (this->ring_ready) {
+            // Drain reads that are still in flight before freeing their buffers.
+            for (auto &slot: this->slots) {
+                while (slot.pending) {
+                    io_uring_cqe *cqe;
+                    if (io_uring_wait_cqe(&this->ring, &cqe) < 0) break;
+                    static_cast<Slot *>(io_uring_cqe_get_data(cqe))->pending = false;
+                    io_uring_cqe_seen(&this->ring, cqe);
+                }
+            }
+            io_uring_queue_exit(&this->ring);
+            this->ring_ready = false;
+        }
+        for (auto &slot: this->slots) free(slot.data);
+        this->slots.clear();
+        if (this->fd >= 0 && this->fd != this->buffered_fd) close(this->fd);
+        if (this->buffered_fd >= 0) close(this->buffered_fd);
+        this->fd = this->buffered_fd = -1;
+    }
+};
+#endif
+
+std::unique_ptr<InputBuffer> open_uring_input(const std::string &path) {
+#ifdef USE_IO_URING
+    auto buf = std::make_unique<UringStreamBuf>(path);
+    if (buf->ready()) return buf;
+#endif
+    return nullptr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <optional>
+#include <streambuf>
+#include <string>
+
+// How read_catalog() gets bytes off disk.
+enum class InputBackend {
+    automatic, // io_uring where available, otherwise mmap
+    uring,     // io_uring with O_DIRECT reads into a ring of aligned buffers
+    mmap,      // the CSV parser's own memory mapped reader
+};
+
+const char *input_backend_name(InputBackend backend);
+std::optional<InputBackend> parse_input_backend(const std::string &name);
+
+// A file's stream buffer that records a failed read instead of throwing:
+// std::istream would catch the exception and report a plain end of file.
+// Check error() once the stream has been read.
+class InputBuffer : public std::streambuf {
+protected:
+    int read_errno = 0;
+
+public:
+    // The errno of the failed read that ended the stream, or 0.
+    int error() const {
+        return this->read_errno;
+    }
+};
+
+// Opens path for reading through io_uring. Returns nullptr when tesslocate was
+// built without io_uring support or the kernel refuses to set up a ring.
+std::unique_ptr<InputBuffer> open_uring_input(const std::string &path);
+
+// An istream that owns its buffer. csv::CSVReader moves the stream it is given
+// into its parser, which a plain std::istream doesn't allow.
+class InputStream : public std::istream {
+    std::unique_ptr<std::streambuf> buf;
+
+public:
+    explicit InputStream(std::unique_ptr<std::streambuf> source) : std::istream(source.get()), buf(std::move(source)) {}
+
+    InputStream(InputStream &&other) noexcept : std::istream(std::move(other)), buf(std::move(other.buf)) {
+        this->set_rdbuf(this->buf.get());
+    }
+};
@@ -0,0 +1,520 @@
+#include "locator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <curl/curl.h>
+#include <s2/s2latlng.h>
+#include <s2/s2cell.h>
+#include <s2/s2cell_id.h>
+#include <s2/s2closest_edge_query.h>
+#include <s2/s2contains_point_query.h>
+#include <s2/s2region_coverer.h>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+std::string cache_dir() {
+#if defined(_WIN32)
+    const char* localAppData = getenv("LOCALAPPDATA");
+    return localAppData ? std::string(localAppData) : ".";
+#else
+    if (const char *xdg = getenv("XDG_CACHE_HOME")) return {xdg};
+    const char *home = getenv("HOME");
+    return home ? std::string(home) + "/.cache/" : ".";
+#endif
+}
+
+// Used in download_footprints b/c libCURL needs a C-style callback.
+static size_t write_callback(const char *ptr, size_t size, size_t nmemb, void *userdata) {
+    size_t total_size = size * nmemb;
+    auto resp = static_cast<std::string *>(userdata);
+    resp->append(ptr, total_size);
+    return total_size;
+}
+
+std::string download_footprints() {
+    std::string response;
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURL *hnd = curl_easy_init();
+    if (!hnd) {
+        std::cerr << "curl_easy_init() failed\n";
+        return "";
+    }
+
+    curl_easy_setopt(hnd, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(hnd, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(hnd, CURLOPT_URL,
+                     "https://stpubdata.s3.amazonaws.com/tess/public/footprints/tess_ffi_footprint_cache.json");
+    CURLcode ret = curl_easy_perform(hnd);
+    if (ret != CURLE_OK) {
+        throw std::runtime_error("Failed to download cache file. Error code: " + std::string(curl_easy_strerror(ret)));
+    }
+
+    curl_easy_cleanup(hnd);
+    return response;
+}
+
+json load_footprints(bool *downloaded) {
+    std::string dir = cache_dir();
+    std::string filename = "tess_ffi_footprint_cache.json";
+    std::filesystem::path p(dir);
+    std::filesystem::create_directories(p);
+    p = p / filename;
+
+    std::string footprints;
+    const bool missing = !std::filesystem::exists(p);
+    if (downloaded) *downloaded = missing;
+    if (missing) {
+        std::cout << "Footprint cache not found, downloading." << std::endl;
+        footprints = download_footprints();
+        std::ofstream file(p);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open footprint cache (" << p.string() << "). Proceeding anyway." << std::endl;
+        } else {
+            file << footprints;
+            std::cout << "Saved footprints to cache file." << std::endl;
+        }
+    } else {
+        std::cout << "Using cached FFI footprints." << std::endl;
+        std::ifstream file(p);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open cached FFI footprints: " + p.string());
+        }
+
+        std::ostringstream buffer;
+        buffer << file.rdbuf();
+        footprints = buffer.str();
+    }
+
+    return json::parse(footprints);
+}
+
+std::filesystem::path config_path() {
+    return std::filesystem::path(cache_dir()) / "tesslocate_config.json";
+}
+
+json load_config() {
+    std::ifstream file(config_path());
+    if (!file.is_open()) return json::object();
+    try {
+        return json::parse(file);
+    } catch (const json::parse_error &e) {
+        std::cerr << "Ignoring invalid config file " << config_path().string() << ": " << e.what() << std::endl;
+        return json::object();
+    }
+}
+
+void save_config(const json &config) {
+    auto path = config_path();
+    std::filesystem::create_directories(path.parent_path());
+    auto tmp = path.string() + ".tmp";
+    std::ofstream file(tmp);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to write config file: " + path.string());
+    }
+    file << config.dump(4);
+    file.close();
+    std::filesystem::rename(tmp, path);
+}
+
+// FNV-1a over the footprint ids and regions.
+std::string footprint_fingerprint(const json &footprints) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&hash](const std::string &s) {
+        for (unsigned char c: s) {
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        }
+        hash = (hash ^ 0xff) * 0x100000001b3ULL;
+    };
+    for (const auto &id: footprints["obs_id"]) mix(id.get<std::string>());
+    for (const auto &region: footprints["s_region"]) mix(region.get<std::string>());
+
+    std::ostringstream ss;
+    ss << std::hex << hash;
+    return ss.str();
+}
+
+S2Point radec_point(double ra, double dec) {
+    ra = (ra > 180.0) ? ra - 360.0 : ra; // normalize ra to [-180, 180]
+    const auto ll = S2LatLng::FromDegrees(dec, ra);
+    return ll.ToPoint();
+}
+
+std::unique_ptr<S2Polygon> load_region(const std::string &region) {
+    std::vector<std::string> parts;
+    std::istringstream ss(region);
+    std::string item;
+    while (std::getline(ss, item, ' ')) {
+        parts.push_back(item);
+    }
+
+    if (parts[0] != "POLYGON") {
+        std::cerr << "Invalid region:" << region << std::endl;
+        return nullptr;
+    }
+
+    if ((parts.size() - 1) % 2 != 0) {
+        std::cerr << "Invalid number of coordinates:" << region << std::endl;
+        return nullptr;
+    }
+
+    std::vector<S2Point> points;
+    for (int i = 1; i < parts.size() - 1; i += 2) {
+        double ra, dec;
+        try {
+            ra = std::stod(parts[i]);
+            dec = std::stod(parts[i + 1]);
+            ra = (ra > 180.0) ? ra - 360.0 : ra; // normalize ra to [-180, 180]
+        } catch (const std::invalid_argument &e) {
+            std::cerr << "Invalid coordinate:" << parts[i] << ", " << parts[i + 1] << std::endl;
+            return nullptr;
+        }
+
+        auto ll = S2LatLng::FromDegrees(dec, ra);
+        points.push_back(ll.ToPoint());
+    }
+
+    if (points.size() >= 2 && points.front() == points.back()) {
+        points.pop_back(); // remove duplicate point
+    }
+
+    auto loop = std::make_unique<S2Loop>(points);
+    loop->Normalize();
+
+    return std::make_unique<S2Polygon>(std::move(loop));
+}
+
+bool region_cap(const std::string &region, S2Cap &cap) {
+    const char *p = region.c_str();
+    if (std::strncmp(p, "POLYGON", 7) != 0) return false;
+    p += 7;
+
+    std::vector<S2Point> points;
+    while (true) {
+        char *end;
+        const double ra = std::strtod(p, &end);
+        if (end == p) break;
+        p = end;
+        const double dec = std::strtod(p, &end);
+        if (end == p) return false;
+        p = end;
+        points.push_back(radec_point(ra, dec));
+    }
+    if (points.empty()) return false;
+
+    S2Point center(0, 0, 0);
+    for (const auto &point: points) center += point;
+    if (center.Norm2() < 1e-20) {
+        cap = S2Cap::Full();
+        return true;
+    }
+    center = center.Normalize();
+
+    // Footprints are convex and far smaller than a hemisphere, so the cap
+    // around the vertices contains the whole polygon.
+    S1Angle radius = S1Angle::Radians(0);
+    for (const auto &point: points) radius = std::max(radius, S1Angle(center, point));
+    cap = S2Cap(center, radius + S1Angle::Degrees(1e-6));
+    return true;
+}
+
+S2CellUnion catalog_covering(const std::vector<S2Point> &points) {
+    std::vector<S2CellId> ids;
+    ids.reserve(points.size());
+    for (const auto &point: points) ids.push_back(S2CellId(point).parent(10));
+    return S2CellUnion(std::move(ids));
+}
+
+const char *engine_name(Engine engine) {
+    switch (engine) {
+        case Engine::scan:
+            return "scan";
+        case Engine::index:
+            return "index";
+        case Engine::cells:
+            return "cells";
+    }
+    return "unknown";
+}
+
+std::optional<Engine> parse_engine(const std::string &name) {
+    for (Engine engine: {Engine::scan, Engine::index, Engine::cells}) {
+        if (name == engine_name(engine)) return engine;
+    }
+    return std::nullopt;
+}
+
+IndexedPolygons IndexedPolygons::load(const S2CellUnion *region) {
+    json footprints = load_footprints();
+    return build(footprints, tuned_options(footprints), region);
+}
+
+IndexedPolygons IndexedPolygons::build(const json &footprints, const MutableS2ShapeIndex::Options &options,
+                                       const S2CellUnion *region) {
+    assert(footprints["obs_id"].size() == footprints["s_region"].size());
+
+    IndexedPolygons res;
+    res.index.Init(options);
+
+    // A few cells around each footprint's vertex bound, each looked up in the
+    // catalog cells by binary search, so the filter doesn't grow with the
+    // product of footprints and catalog cells.
+    S2RegionCoverer::Options cap_options;
+    cap_options.set_max_cells(8);
+    S2RegionCoverer coverer(cap_options);
+    std::vector<S2CellId> cap_cells;
+
+    const auto &ids = footprints["obs_id"];
+    const auto &regions = footprints["s_region"];
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const auto &text = regions[i].get_ref<const std::string &>();
+        if (region) {
+            // Skip footprints whose vertex bound misses every catalog cell,
+            // before paying for the polygon.
+            S2Cap cap;
+            if (region_cap(text, cap)) {
+                coverer.GetCovering(cap, &cap_cells);
+                if (std::none_of(cap_cells.begin(), cap_cells.end(),
+                                 [region](S2CellId id) { return region->Intersects(id); })) {
+                    continue;
+                }
+            }
+        }
+
+        auto poly = load_region(text);
+        res.names.push_back(ids[i].get<std::string>());
+        res.index.Add(std::make_unique<S2Polygon::Shape>(poly.get()));
+        res.caps.push_back(poly->GetCapBound());
+        res.polygons.push_back(std::move(poly));
+    }
+
+    return res;
+}
+
+MutableS2ShapeIndex::Options IndexedPolygons::tuned_options(const json &footprints) {
+    MutableS2ShapeIndex::Options options;
+    json config = load_config();
+    if (!config.contains("index")) return options;
+
+    const auto &tuned = config["index"];
+    if (tuned.value("footprints", "") != footprint_fingerprint(footprints)) {
+        std::cout << "Footprints changed since the index was tuned, using default index options." << std::endl;
+        return options;
+    }
+
+    options.set_max_edges_per_cell(tuned.value("max_edges_per_cell", options.max_edges_per_cell()));
+    std::cout << "Using tuned index options (max_edges_per_cell=" << options.max_edges_per_cell() << ")." <<
+        std::endl;
+    return options;
+}
+
+void IndexedPolygons::build_cell_table(int level) {
+    // Covering and interior covering of every footprint at the table level.
+    // A cell in the covering but not the interior is crossed by an edge.
+    std::vector<std::vector<std::pair<uint64_t, bool> > > per_polygon(this->polygons.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < static_cast<int>(this->polygons.size()); ++i) {
+        S2RegionCoverer::Options options;
+        options.set_fixed_level(level);
+        options.set_max_cells(INT_MAX);
+        S2RegionCoverer coverer(options);
+
+        std::vector<S2CellId> covering, interior;
+        coverer.GetCovering(*this->polygons[i], &covering);
+        coverer.GetInteriorCovering(*this->polygons[i], &interior);
+        std::sort(interior.begin(), interior.end());
+        for (const auto &id: covering) {
+            per_polygon[i].emplace_back(id.id(), std::binary_search(interior.begin(), interior.end(), id));
+        }
+    }
+
+    struct Item {
+        uint64_t id;
+        ObservationHandle handle;
+        bool interior;
+    };
+    std::vector<Item> items;
+    for (int i = 0; i < static_cast<int>(per_polygon.size()); ++i) {
+        for (const auto &[id, interior]: per_polygon[i]) items.push_back({id, i, interior});
+        std::vector<std::pair<uint64_t, bool> >().swap(per_polygon[i]);
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        return a.id != b.id ? a.id < b.id : a.handle < b.handle;
+    });
+
+    this->cells.clear();
+    this->cell_handles.clear();
+    for (size_t i = 0; i < items.size();) {
+        size_t j = i;
+        bool boundary = false;
+        while (j < items.size() && items[j].id == items[i].id) boundary |= !items[j++].interior;
+
+        CellEntry entry{items[i].id, static_cast<uint32_t>(this->cell_handles.size()), 0, boundary};
+        if (!boundary) {
+            for (size_t k = i; k < j; ++k) this->cell_handles.push_back(items[k].handle);
+        }
+        entry.end = static_cast<uint32_t>(this->cell_handles.size());
+        this->cells.push_back(entry);
+        i = j;
+    }
+    this->cell_level = level;
+}
+
+void IndexedPolygons::search(const S2Point &point, Engine engine, std::vector<ObservationHandle> &res) const {
+    switch (engine) {
+        case Engine::scan:
+            search_scan(point, res);
+            break;
+        case Engine::index:
+            search_refined(point, res);
+            break;
+        case Engine::cells:
+            search_cells(point, res);
+            break;
+    }
+}
+
+void IndexedPolygons::search_scan(const S2Point &point, std::vector<ObservationHandle> &res) const {
+    for (int i = 0; i < static_cast<int>(this->polygons.size()); ++i) {
+        if (this->caps[i].Contains(point) && this->polygons[i]->Contains(point)) {
+            res.push_back(i);
+        }
+    }
+}
+
+void IndexedPolygons::search_index(const S2Point &point, std::vector<ObservationHandle> &res) const {
+    auto query = S2ContainsPointQuery(&this->index);
+    query.VisitContainingShapes(point, [&res](const auto &shape) {
+        res.push_back(shape->id());
+        return true;
+    });
+}
+
+void IndexedPolygons::force_build() {
+    this->index.ForceBuild();
+
+    this->index_cells.clear();
+    this->index_cell_handles.clear();
+    for (MutableS2ShapeIndex::Iterator it(&this->index, S2ShapeIndex::BEGIN); !it.done(); it.Next()) {
+        const S2ShapeIndexCell &cell = it.cell();
+        CellEntry entry{it.id().id(), static_cast<uint32_t>(this->index_cell_handles.size()), 0, false};
+        // Clipped shapes come in shape id order. One without edges is only
+        // kept when it contains the whole cell.
+        for (int k = 0; k < cell.num_clipped(); ++k) {
+            const S2ClippedShape &clipped = cell.clipped(k);
+            if (clipped.num_edges() > 0) {
+                this->index_cell_handles.push_back(~clipped.shape_id());
+                entry.boundary = true;
+            } else if (clipped.contains_center()) {
+                this->index_cell_handles.push_back(clipped.shape_id());
+            }
+        }
+        entry.end = static_cast<uint32_t>(this->index_cell_handles.size());
+        this->index_cells.push_back(entry);
+    }
+}
+
+bool IndexedPolygons::search_refined(const S2Point &point, std::vector<ObservationHandle> &res) const {
+    if (this->index_cells.empty()) {
+        search_index(point, res);
+        return false;
+    }
+
+    // Index cells don't overlap, so they are ordered by their last leaf too.
+    const S2CellId leaf(point);
+    auto it = std::lower_bound(this->index_cells.begin(), this->index_cells.end(), leaf, [](const CellEntry &e,
+                                                                                         S2CellId leaf) {
+        return S2CellId(e.id).range_max() < leaf;
+    });
+    if (it == this->index_cells.end() || S2CellId(it->id).range_min() > leaf) return true; // outside every footprint
+
+    if (!it->boundary) {
+        res.insert(res.end(), this->index_cell_handles.begin() + it->begin,
+                   this->index_cell_handles.begin() + it->end);
+        return true;
+    }
+    // Only footprints with edges in the cell need an exact test.
+    auto query = S2ContainsPointQuery(&this->index);
+    for (uint32_t k = it->begin; k < it->end; ++k) {
+        const ObservationHandle h = this->index_cell_handles[k];
+        if (h >= 0) {
+            res.push_back(h);
+        } else if (query.ShapeContains(*this->index.shape(~h), point)) {
+            res.push_back(~h);
+        }
+    }
+    return false;
+}
+
+void IndexedPolygons::search_cells(const S2Point &point, std::vector<ObservationHandle> &res) const {
+    assert(this->cell_level >= 0);
+    const uint64_t id = S2CellId(point).parent(this->cell_level).id();
+    auto it = std::lower_bound(this->cells.begin(), this->cells.end(), id, [](const CellEntry &e, uint64_t id) {
+        return e.id < id;
+    });
+    if (it == this->cells.end() || it->id != id) return; // outside every footprint
+    if (it->boundary) {
+        search_index(point, res);
+        return;
+    }
+    res.insert(res.end(), this->cell_handles.begin() + it->begin, this->cell_handles.begin() + it->end);
+}
+
+bool IndexedPolygons::search_cap(const S2Cap &cap, std::vector<ObservationHandle> &res) const {
+    // Only edges count; a footprint containing the whole cap is fine.
+    S2ClosestEdgeQuery::Options options;
+    options.set_include_interiors(false);
+    S2ClosestEdgeQuery query(&this->index, options);
+    S2ClosestEdgeQuery::PointTarget target(cap.center());
+    if (query.IsDistanceLessOrEqual(&target, cap.radius())) return false;
+    search_index(cap.center(), res);
+    return true;
+}
+
+// Planner thresholds. The scan engine avoids building the shape index, which
+// costs a few hundred milliseconds, but does work proportional to the footprint
+// count per query. The cell table costs a few seconds to build and only pays
+// off for very large catalogs that spread over much of the sky.
+constexpr double kScanMaxWork = 4e6;        // rows x footprints
+constexpr size_t kCellTableMinRows = 20000000;
+constexpr double kCellTableMinSpread = 0.25;
+constexpr int kSpreadLevel = 6;             // about 1.3 degrees across
+
+QueryPlan plan_query(size_t rows, const std::vector<S2Point> &sample, size_t footprints, int threads) {
+    QueryPlan plan;
+
+    std::vector<uint64_t> sample_cells;
+    for (const auto &p: sample) sample_cells.push_back(S2CellId(p).parent(kSpreadLevel).id());
+    std::sort(sample_cells.begin(), sample_cells.end());
+    const auto distinct = std::unique(sample_cells.begin(), sample_cells.end()) - sample_cells.begin();
+    plan.spread = sample.empty() ? 0.0 : static_cast<double>(distinct) / sample.size();
+
+    std::ostringstream reason;
+    if (static_cast<double>(rows) * footprints <= kScanMaxWork) {
+        plan.engine = Engine::scan;
+        reason << rows << " rows x " << footprints << " footprints is below the index build cost";
+    } else if (rows >= kCellTableMinRows && plan.spread >= kCellTableMinSpread) {
+        plan.engine = Engine::cells;
+        reason << rows << " rows spread over the sky (spread " << plan.spread << ") amortize the cell table";
+    } else {
+        plan.engine = Engine::index;
+        reason << rows << " rows, spread " << plan.spread;
+    }
+    plan.reason = reason.str();
+
+    // Enough chunks per thread to balance uneven footprint density, but large
+    // enough to keep scheduling overhead negligible.
+    const size_t per_thread = rows / std::max(1, threads) / 32;
+    plan.chunk_size = static_cast<int>(std::clamp<size_t>(per_thread, 16, 4096));
+    return plan;
+}
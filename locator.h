@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <s2/s2point.h>
+#include <s2/s2cap.h>
+#include <s2/s2cell_union.h>
+#include <s2/s2polygon.h>
+#include <s2/mutable_s2shape_index.h>
+
+using json = nlohmann::json;
+
+std::string cache_dir();
+
+// Path of the tesslocate config file, which lives next to the footprint cache.
+std::filesystem::path config_path();
+json load_config();
+void save_config(const json &config);
+
+// Download the footprint cache file from S3.
+std::string download_footprints();
+
+// Loads the footprint cache file or downloads if it doesn't exist. Sets
+// *downloaded, if given, to whether the file had to be downloaded.
+json load_footprints(bool *downloaded = nullptr);
+
+// Identifies a set of footprints so tuned settings are only reused for the
+// footprint cache they were measured on.
+std::string footprint_fingerprint(const json &footprints);
+
+// Create an S2 point from a right ascension and declination
+S2Point radec_point(double ra, double dec);
+
+// Create an S2 polygon from the text format used in the footprint cache:
+// POLYGON RA1 DEC1 RA2 DEC2...
+std::unique_ptr<S2Polygon> load_region(const std::string &region);
+
+// Bounding cap of a footprint region, read straight from its vertex string
+// without building the polygon. Returns false if the region is not a POLYGON.
+bool region_cap(const std::string &region, S2Cap &cap);
+
+// Cheap covering of a catalog: the union of the level-10 cells (about 0.1
+// degrees across) that contain its positions.
+S2CellUnion catalog_covering(const std::vector<S2Point> &points);
+
+// Point lookup strategies over the same footprints. All of them return the
+// same footprints, in ascending handle order.
+enum class Engine {
+    scan,  // cap-prefiltered brute force over every footprint; no index build
+    index, // the shape index: cells no footprint edge crosses answer from a list built by force_build(), the
+           // rest go through S2ContainsPointQuery (search_index(), the reference path)
+    cells, // fixed-level cell table, falling back to the index near CCD edges
+};
+
+const char *engine_name(Engine engine);
+std::optional<Engine> parse_engine(const std::string &name);
+
+// A footprint's position in IndexedPolygons; IndexedPolygons::name() gives its obs_id.
+using ObservationHandle = int;
+
+class IndexedPolygons {
+    MutableS2ShapeIndex index;
+    std::vector<std::unique_ptr<S2Polygon> > polygons;
+    std::vector<S2Cap> caps;
+    std::vector<std::string> names;
+
+    // Cell table for Engine::cells: every cell at cell_level that touches a
+    // footprint, sorted by id. Cells crossed by a footprint edge are flagged
+    // as boundary; the others list the footprints that contain them entirely.
+    struct CellEntry {
+        uint64_t id;
+        uint32_t begin;
+        uint32_t end;
+        bool boundary;
+    };
+
+    int cell_level = -1;
+    std::vector<CellEntry> cells;
+    std::vector<ObservationHandle> cell_handles;
+
+    // The same for the shape index's own cells, for Engine::index: each cell
+    // lists every footprint that contains or crosses it, in handle order, with
+    // crossing footprints stored as ~handle. boundary is set if any crosses.
+    std::vector<CellEntry> index_cells;
+    std::vector<ObservationHandle> index_cell_handles;
+
+public:
+    // Loads the footprints, or with a region only those that may intersect it.
+    static IndexedPolygons load(const S2CellUnion *region = nullptr);
+    static IndexedPolygons build(const json &footprints, const MutableS2ShapeIndex::Options &options,
+                                 const S2CellUnion *region = nullptr);
+
+    // Index options chosen by `tesslocate tune` for this footprint set, or the
+    // S2 defaults if it has not been tuned.
+    static MutableS2ShapeIndex::Options tuned_options(const json &footprints);
+
+    // Builds the index now instead of on the first query, along with the
+    // per-cell lists that let Engine::index skip exact tests.
+    void force_build();
+
+    // Builds the table used by Engine::cells.
+    void build_cell_table(int level);
+
+    size_t size() const {
+        return this->names.size();
+    }
+
+    const std::string &name(ObservationHandle handle) const {
+        return this->names[handle];
+    }
+
+    // Appends the footprints containing point to res.
+    void search(const S2Point &point, Engine engine, std::vector<ObservationHandle> &res) const;
+    void search_scan(const S2Point &point, std::vector<ObservationHandle> &res) const;
+    void search_index(const S2Point &point, std::vector<ObservationHandle> &res) const;
+
+    // Engine::index. Returns true if the point's index cell is crossed by no
+    // footprint edge, so the result came straight from the cell's list. Falls
+    // back to search_index() until force_build() has run.
+    bool search_refined(const S2Point &point, std::vector<ObservationHandle> &res) const;
+    void search_cells(const S2Point &point, std::vector<ObservationHandle> &res) const;
+
+    // When no footprint edge reaches into cap, every point in it lies in the
+    // same footprints: appends those to res and returns true. Returns false
+    // without touching res when an edge does.
+    bool search_cap(const S2Cap &cap, std::vector<ObservationHandle> &res) const;
+
+    std::vector<ObservationHandle> search(const S2Point &point) const {
+        std::vector<ObservationHandle> res;
+        search_index(point, res);
+        return res;
+    }
+};
+
+// Level of the cells in the Engine::cells table (about 0.3 degrees across).
+constexpr int kCellTableLevel = 8;
+
+struct QueryPlan {
+    Engine engine;
+    int chunk_size;
+    double spread; // distinct sampled cells per sampled position
+    std::string reason;
+};
+
+// Chooses the lookup engine and the parallel chunk size for a catalog from its
+// size, the sky spread of a sample of its positions and the footprint count.
+QueryPlan plan_query(size_t rows, const std::vector<S2Point> &sample, size_t footprints, int threads);
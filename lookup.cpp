@@ -0,0 +1,120 @@
+#include "lookup.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "output.h"
+
+static constexpr char kMagic[8] = "TESSLKP";
+
+LookupIndex::LookupIndex(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open lookup index: " + path);
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    this->map_size = st.st_size;
+    if (this->map_size < 16) {
+        close(fd);
+        throw std::runtime_error("Invalid lookup index: " + path);
+    }
+    this->map = mmap(nullptr, this->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->map == MAP_FAILED) {
+        this->map = nullptr;
+        throw std::runtime_error("Failed to map lookup index: " + path);
+    }
+
+    const auto *base = static_cast<const char *>(this->map);
+    std::memcpy(&this->count, base + 8, sizeof(this->count));
+    if (std::memcmp(base, kMagic, sizeof(kMagic)) != 0 ||
+        this->map_size != 16 + sizeof(LookupEntry) * this->count) {
+        munmap(this->map, this->map_size);
+        this->map = nullptr;
+        throw std::runtime_error("Invalid lookup index: " + path);
+    }
+    this->entries = reinterpret_cast<const LookupEntry *>(base + 16);
+    madvise(this->map, this->map_size, MADV_RANDOM);
+}
+
+LookupIndex::~LookupIndex() {
+    if (this->map) munmap(this->map, this->map_size);
+}
+
+std::vector<LookupEntry> LookupIndex::find(std::string_view ID) const {
+    const uint64_t hash = lookup_hash(ID);
+    const auto *end = this->entries + this->count;
+    const auto *it = std::lower_bound(this->entries, end, hash,
+                                      [](const LookupEntry &e, uint64_t h) { return e.hash < h; });
+    std::vector<LookupEntry> res;
+    for (; it != end && it->hash == hash; ++it) {
+        res.push_back(*it);
+    }
+    return res;
+}
+
+uint64_t lookup_hash(std::string_view ID) {
+    // FNV-1a.
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: ID) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string lookup_index_path(const std::string &results_path) {
+    return sidecar_path(results_path, ".lookup");
+}
+
+void write_lookup_index(const std::string &path, std::vector<LookupEntry> &entries) {
+    std::sort(entries.begin(), entries.end(), [](const LookupEntry &a, const LookupEntry &b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.offset < b.offset;
+    });
+
+    std::ofstream out(path, std::ios::binary);
+    const uint64_t count = entries.size();
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char *>(entries.data()), static_cast<std::streamsize>(sizeof(LookupEntry) * count));
+    if (!out) {
+        throw std::runtime_error("Failed to write lookup index: " + path);
+    }
+}
+
+size_t lookup_rows(const std::string &results_path, std::string_view ID, std::ostream &out) {
+    LookupIndex index(lookup_index_path(results_path));
+    std::ifstream results(results_path, std::ios::binary);
+    if (!results) {
+        throw std::runtime_error("Failed to open " + results_path);
+    }
+
+    std::string header;
+    std::getline(results, header);
+    out << header << "\n";
+
+    size_t rows = 0;
+    for (const auto &entry: index.find(ID)) {
+        std::string block(entry.length, '\0');
+        results.clear();
+        results.seekg(static_cast<std::streamoff>(entry.offset));
+        results.read(block.data(), static_cast<std::streamsize>(entry.length));
+        if (results.gcount() != static_cast<std::streamsize>(entry.length)) {
+            throw std::runtime_error("Lookup index does not match " + results_path);
+        }
+
+        // The block holds one target's rows; skip it unless the ID really matches.
+        if (block.size() <= ID.size() || block.compare(0, ID.size(), ID) != 0 || block[ID.size()] != ',') {
+            continue;
+        }
+        out << block;
+        rows += std::count(block.begin(), block.end(), '\n');
+    }
+    return rows;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where one target's rows sit in a CSV result file.
+struct LookupEntry {
+    uint64_t hash;   // lookup_hash() of the ID
+    uint64_t offset; // byte offset of the target's first row
+    uint64_t length; // bytes covered by all of the target's rows
+};
+
+// A sorted (ID hash -> offset, length) sidecar for a CSV result file, memory
+// mapped so a single target's rows can be read without scanning the results.
+//
+// File layout (native endianness):
+//   char        magic[8]    "TESSLKP"
+//   uint64_t    count
+//   LookupEntry entries[count]  ascending by hash
+class LookupIndex {
+    void *map = nullptr;
+    size_t map_size = 0;
+    const LookupEntry *entries = nullptr;
+    uint64_t count = 0;
+
+public:
+    explicit LookupIndex(const std::string &path);
+    ~LookupIndex();
+    LookupIndex(const LookupIndex &) = delete;
+    LookupIndex &operator=(const LookupIndex &) = delete;
+
+    // Entries whose hash matches ID. Hash collisions are possible, so callers
+    // check the IDs in the rows themselves.
+    std::vector<LookupEntry> find(std::string_view ID) const;
+};
+
+uint64_t lookup_hash(std::string_view ID);
+
+// The sidecar's path for a result file: its extension replaced by .lookup.
+std::string lookup_index_path(const std::string &results_path);
+
+// Sorts entries and writes them as a LookupIndex file.
+void write_lookup_index(const std::string &path, std::vector<LookupEntry> &entries);
+
+// Writes the header of the result file and the rows belonging to ID to out.
+// Returns the number of rows found.
+size_t lookup_rows(const std::string &results_path, std::string_view ID, std::ostream &out);
@@ -3,273 +3,804 @@
 #include <sstream>
 #include <filesystem>
 #include <fstream>
+#include <chrono>
+#include <random>
+#include <optional>
 #include <curl/curl.h>
+#include <absl/base/config.h>
 #include "external/cxxopts.h"
 #include "external/csv.h"
 #include <nlohmann/json.hpp>
 #include <s2/s2point.h>
-#include <s2/s2latlng.h>
-#include <s2/s2polygon.h>
-#include <s2/s2contains_point_query.h>
+#include "locator.h"
+#include "catalog.h"
+#include "tic_index.h"
+#include "metrics.h"
+#include "output.h"
+#include "obs_sets.h"
+#include "estimate.h"
+#include "verify.h"
+#include "lookup.h"
+#include "compiled_catalog.h"
+#include "partitions.h"
+#include "cutout.h"
+#include "xmatch.h"
+#include "sharded_index.h"
 
 #ifdef USE_OPENMP
 #include <omp.h>
 #endif
 
-using json = nlohmann::json;
-using ojson = nlohmann::ordered_json;
-
-std::string cache_dir() {
-#if defined(_WIN32)
-    const char* localAppData = getenv("LOCALAPPDATA");
-    return localAppData ? std::string(localAppData) : ".";
-#else
-    if (const char *xdg = getenv("XDG_CACHE_HOME")) return {xdg};
-    const char *home = getenv("HOME");
-    return home ? std::string(home) + "/.cache/" : ".";
+// Print the versions of tesslocate and the libraries it was built against, so
+// benchmark reports can tell which toolchain produced them.
+void print_version() {
+    std::cout << "tesslocate " << TESSLOCATE_VERSION << std::endl;
+#if defined(__clang__)
+    std::cout << "compiler: clang " << __clang_version__ << std::endl;
+#elif defined(__GNUC__)
+    std::cout << "compiler: gcc " << __VERSION__ << std::endl;
+#endif
+    std::cout << "nlohmann_json: " << NLOHMANN_JSON_VERSION_MAJOR << "." << NLOHMANN_JSON_VERSION_MINOR << "."
+        << NLOHMANN_JSON_VERSION_PATCH << std::endl;
+    std::cout << "curl: " << LIBCURL_VERSION << std::endl;
+#ifdef ABSL_LTS_RELEASE_VERSION
+    std::cout << "abseil: " << ABSL_LTS_RELEASE_VERSION << "." << ABSL_LTS_RELEASE_PATCH_LEVEL << std::endl;
+#endif
+#ifdef _OPENMP
+    std::cout << "openmp: " << _OPENMP << std::endl;
 #endif
 }
 
-// Used in download_footprints b/c libCURL needs a C-style callback.
-static size_t write_callback(const char *ptr, size_t size, size_t nmemb, void *userdata) {
-    size_t total_size = size * nmemb;
-    auto resp = static_cast<std::string *>(userdata);
-    resp->append(ptr, total_size);
-    return total_size;
-}
-
-// Download the footprint cache file from S3.
-std::string download_footprints() {
-    std::string response;
-
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    CURL *hnd = curl_easy_init();
-    if (!hnd) {
-        std::cerr << "curl_easy_init() failed\n";
-        return "";
+// `tesslocate tune`: time point queries over a sample of a catalog for a range
+// of MutableS2ShapeIndex options and save the fastest in the config file, so
+// later runs on the same footprint set use it automatically.
+int run_tune(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate tune", "Tune the footprint index for a catalog");
+    options.add_options()("input", "path to csv with columns ID, ra, dec", cxxopts::value<std::string>())(
+        "sample", "number of catalog rows to query", cxxopts::value<size_t>()->default_value("200000"))(
+        "max-edges", "comma separated max_edges_per_cell values to try",
+        cxxopts::value<std::vector<int> >()->default_value("2,4,6,10,16,24,32,48,64"))(
+        "repeat", "timed passes per candidate (fastest is kept)", cxxopts::value<int>()->default_value("3"))(
+        "threads", "number of worker threads (default: all cores)", cxxopts::value<int>());
+    options.parse_positional({"input"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("input")) {
+        std::cerr << options.help() << std::endl;
+        return 1;
     }
-
-    curl_easy_setopt(hnd, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(hnd, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(hnd, CURLOPT_URL,
-                     "https://stpubdata.s3.amazonaws.com/tess/public/footprints/tess_ffi_footprint_cache.json");
-    CURLcode ret = curl_easy_perform(hnd);
-    if (ret != CURLE_OK) {
-        throw std::runtime_error("Failed to download cache file. Error code: " + std::string(curl_easy_strerror(ret)));
+    auto input = result["input"].as<std::string>();
+    if (!std::filesystem::exists(input)) {
+        std::cout << "File " << input << " does not exist." << std::endl;
+        return 1;
     }
+#ifdef USE_OPENMP
+    if (result.count("threads")) {
+        omp_set_num_threads(result["threads"].as<int>());
+    }
+#endif
 
-    curl_easy_cleanup(hnd);
-    return response;
-}
-
-// Loads the footprint cache file or downloads if it doesn't exist.
-json load_footprints() {
-    std::string dir = cache_dir();
-    std::string filename = "tess_ffi_footprint_cache.json";
-    std::filesystem::path p(dir);
-    std::filesystem::create_directories(p);
-    p = p / filename;
-
-    std::string footprints;
-    if (!std::filesystem::exists(p)) {
-        std::cout << "Footprint cache not found, downloading." << std::endl;
-        footprints = download_footprints();
-        std::ofstream file(p);
-        if (!file.is_open()) {
-            std::cerr << "Failed to open footprint cache (" << p.string() << "). Proceeding anyway." << std::endl;
+    // Reservoir sample of the catalog positions. Malformed rows are left out
+    // by the reader rather than ending the run.
+    const Catalog catalog = read_catalog(input);
+    if (!catalog.has_positions) {
+        std::cerr << input << " has no ra and dec columns." << std::endl;
+        return 1;
+    }
+    if (!catalog.rejects.empty()) {
+        std::cerr << "Skipped " << catalog.rejects.size() << " malformed rows." << std::endl;
+    }
+    const size_t sample_size = result["sample"].as<size_t>();
+    std::vector<S2Point> sample;
+    std::mt19937_64 rng(42);
+    size_t seen = 0;
+    for (size_t i = 0; i < catalog.size(); ++i) {
+        S2Point point = radec_point(catalog.ra[i], catalog.dec[i]);
+        if (sample.size() < sample_size) {
+            sample.push_back(point);
         } else {
-            file << footprints;
-            std::cout << "Saved footprints to cache file." << std::endl;
+            size_t j = std::uniform_int_distribution<size_t>(0, seen)(rng);
+            if (j < sample_size) sample[j] = point;
         }
-    } else {
-        std::cout << "Using cached FFI footprints." << std::endl;
-        std::ifstream file(p);
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open cached FFI footprints: " + p.string());
+        ++seen;
+    }
+    if (sample.empty()) {
+        std::cerr << "Catalog is empty." << std::endl;
+        return 1;
+    }
+    std::cout << "Tuning on " << sample.size() << " of " << seen << " positions." << std::endl;
+
+    json footprints = load_footprints();
+    const int repeat = std::max(1, result["repeat"].as<int>());
+    int best = -1;
+    double best_seconds = 0;
+    for (int max_edges: result["max-edges"].as<std::vector<int> >()) {
+        MutableS2ShapeIndex::Options index_options;
+        index_options.set_max_edges_per_cell(max_edges);
+
+        auto start = std::chrono::steady_clock::now();
+        IndexedPolygons index = IndexedPolygons::build(footprints, index_options);
+        index.force_build();
+        std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+
+        double query = 0;
+        size_t fast_path = 0;
+        for (int r = 0; r < repeat; ++r) {
+            size_t hits = 0;
+            fast_path = 0;
+            start = std::chrono::steady_clock::now();
+#ifdef USE_OPENMP
+#pragma omp parallel for reduction(+:hits, fast_path)
+#endif
+            for (int64_t i = 0; i < static_cast<int64_t>(sample.size()); ++i) {
+                std::vector<ObservationHandle> res;
+                fast_path += index.search_refined(sample[i], res);
+                hits += res.size();
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            query = r == 0 ? elapsed.count() : std::min(query, elapsed.count());
         }
 
-        std::ostringstream buffer;
-        buffer << file.rdbuf();
-        footprints = buffer.str();
+        std::cout << "max_edges_per_cell=" << max_edges << ": build " << build.count() << " s, queries " << query <<
+            " s (" << sample.size() / query << " queries/s, " << 100.0 * fast_path / sample.size() <<
+            "% without exact tests)" << std::endl;
+        if (best < 0 || query < best_seconds) {
+            best = max_edges;
+            best_seconds = query;
+        }
     }
 
-    return json::parse(footprints);
-}
-
-// Create an S2 point from a right ascension and declination
-S2Point radec_point(double ra, double dec) {
-    ra = (ra > 180.0) ? ra - 360.0 : ra; // normalize ra to [-180, 180]
-    const auto ll = S2LatLng::FromDegrees(dec, ra);
-    return ll.ToPoint();
+    json config = load_config();
+    config["index"] = {
+        {"max_edges_per_cell", best},
+        {"footprints", footprint_fingerprint(footprints)},
+    };
+    save_config(config);
+    std::cout << "Saved max_edges_per_cell=" << best << " to " << config_path().string() << "." << std::endl;
+    return 0;
 }
 
-// Create an S2 polygon from the text format used in the footprint cache:
-// POLYGON RA1 DEC1 RA2 DEC2...
-std::unique_ptr<S2Polygon> load_region(const std::string &region) {
-    std::vector<std::string> parts;
-    std::istringstream ss(region);
-    std::string item;
-    while (std::getline(ss, item, ' ')) {
-        parts.push_back(item);
+// `tesslocate tic-index build <extract.csv> [out]`: convert a local TIC extract
+// into the mmappable table used to resolve ID-only input.
+int run_tic_index(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate tic-index", "Build a TIC position index");
+    options.add_options()("command", "build", cxxopts::value<std::string>())(
+        "input", "csv extract with columns ID, ra, dec", cxxopts::value<std::string>())(
+        "output", "index path (default: in the cache directory)",
+        cxxopts::value<std::string>()->default_value(default_tic_index_path()));
+    options.parse_positional({"command", "input", "output"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("command") || result["command"].as<std::string>() != "build" || !result.count("input")) {
+        std::cerr << "usage: tesslocate tic-index build <extract.csv> [output]" << std::endl;
+        return 1;
     }
 
-    if (parts[0] != "POLYGON") {
-        std::cerr << "Invalid region:" << region << std::endl;
-        return nullptr;
+    auto input = result["input"].as<std::string>();
+    if (!std::filesystem::exists(input)) {
+        std::cout << "File " << input << " does not exist." << std::endl;
+        return 1;
     }
+    build_tic_index(input, result["output"].as<std::string>());
+    return 0;
+}
 
-    if ((parts.size() - 1) % 2 != 0) {
-        std::cerr << "Invalid number of coordinates:" << region << std::endl;
-        return nullptr;
+// `tesslocate lookup <results.csv> <ID>`: print one target's rows using the
+// sidecar written with --lookup-index.
+int run_lookup(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate lookup", "Look up a target in a CSV result file");
+    options.add_options()("results", "csv result file written with --lookup-index", cxxopts::value<std::string>())(
+        "id", "target ID", cxxopts::value<std::string>());
+    options.parse_positional({"results", "id"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("results") || !result.count("id")) {
+        std::cerr << "usage: tesslocate lookup <results.csv> <ID>" << std::endl;
+        return 1;
     }
 
-    std::vector<S2Point> points;
-    for (int i = 1; i < parts.size() - 1; i += 2) {
-        double ra, dec;
-        try {
-            ra = std::stod(parts[i]);
-            dec = std::stod(parts[i + 1]);
-            ra = (ra > 180.0) ? ra - 360.0 : ra; // normalize ra to [-180, 180]
-        } catch (const std::invalid_argument &e) {
-            std::cerr << "Invalid coordinate:" << parts[i] << ", " << parts[i + 1] << std::endl;
-            return nullptr;
-        }
-
-        auto ll = S2LatLng::FromDegrees(dec, ra);
-        points.push_back(ll.ToPoint());
+    auto results = result["results"].as<std::string>();
+    if (!std::filesystem::exists(lookup_index_path(results))) {
+        std::cout << "File " << lookup_index_path(results) << " does not exist." << std::endl;
+        return 1;
     }
+    return lookup_rows(results, result["id"].as<std::string>(), std::cout) > 0 ? 0 : 1;
+}
 
-    if (points.size() >= 2 && points.front() == points.back()) {
-        points.pop_back(); // remove duplicate point
+// `tesslocate catalog compile <in.csv> <out.tcat>`: parse a catalog once into
+// the binary form that later runs load without touching the CSV.
+int run_catalog(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate catalog", "Compile a catalog for repeated runs");
+    options.add_options()("command", "compile", cxxopts::value<std::string>())(
+        "input", "csv with columns ID, ra, dec", cxxopts::value<std::string>())(
+        "output", "compiled catalog path (.tcat)", cxxopts::value<std::string>());
+    options.parse_positional({"command", "input", "output"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("command") || result["command"].as<std::string>() != "compile" || !result.count("input") ||
+        !result.count("output")) {
+        std::cerr << "usage: tesslocate catalog compile <in.csv> <out.tcat>" << std::endl;
+        return 1;
     }
 
-    auto loop = std::make_unique<S2Loop>(points);
-    loop->Normalize();
-
-    return std::make_unique<S2Polygon>(std::move(loop));
+    auto input = result["input"].as<std::string>();
+    if (!std::filesystem::exists(input)) {
+        std::cout << "File " << input << " does not exist." << std::endl;
+        return 1;
+    }
+    Catalog catalog = read_catalog(input);
+    if (!catalog.rejects.empty()) {
+        std::cerr << "Skipped " << catalog.rejects.size() << " malformed rows." << std::endl;
+    }
+    compile_catalog(catalog, result["output"].as<std::string>());
+    std::cout << "Compiled " << catalog.size() << " rows to " << result["output"].as<std::string>() << "."
+        << std::endl;
+    return 0;
 }
 
-class IndexedPolygons {
-    MutableS2ShapeIndex index;
-    std::vector<std::unique_ptr<S2Polygon> > polygons;
-    std::vector<std::string> names;
-
-public:
-    static IndexedPolygons load() {
-        json footprints = load_footprints();
-        assert(footprints["obs_id"].size() == footprints["s_region"].size());
+// `tesslocate cutout <results.csv> <ffi-dir> <out-dir>`: cut every target in a
+// CSV result file out of a local FFI mirror, mapping each FFI once.
+int run_cutout(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate cutout", "Extract target cutouts from local FFIs");
+    options.add_options()("results", "csv result file", cxxopts::value<std::string>())(
+        "ffis", "directory of FFI files as named by MAST", cxxopts::value<std::string>())(
+        "output", "directory for the per-target cubes", cxxopts::value<std::string>())(
+        "size", "cutout side in pixels (odd)", cxxopts::value<int>()->default_value("11"))(
+        "memory", "MiB of cutouts to hold before writing them out",
+        cxxopts::value<size_t>()->default_value("1024"))(
+        "threads", "number of worker threads (default: all cores)", cxxopts::value<int>());
+    options.parse_positional({"results", "ffis", "output"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("results") || !result.count("ffis") || !result.count("output")) {
+        std::cerr << "usage: tesslocate cutout <results.csv> <ffi-dir> <out-dir> [--size N]" << std::endl;
+        return 1;
+    }
+    for (const auto *key: {"results", "ffis"}) {
+        if (!std::filesystem::exists(result[key].as<std::string>())) {
+            std::cout << "File " << result[key].as<std::string>() << " does not exist." << std::endl;
+            return 1;
+        }
+    }
+#ifdef USE_OPENMP
+    if (result.count("threads")) {
+        omp_set_num_threads(result["threads"].as<int>());
+    }
+#endif
 
-        IndexedPolygons res;
-        res.names = footprints["obs_id"].get<std::vector<std::string> >();
+    CutoutOptions cutout_options;
+    cutout_options.size = result["size"].as<int>();
+    cutout_options.memory = result["memory"].as<size_t>() << 20;
+    const auto summary = extract_cutouts(result["results"].as<std::string>(), result["ffis"].as<std::string>(),
+                                         result["output"].as<std::string>(), cutout_options);
+    std::cout << "Wrote " << summary.frames << " cutouts of " << summary.targets << " targets from " << summary.ffis
+        << " FFIs in " << summary.passes << " passes to " << result["output"].as<std::string>() << "." << std::endl;
+    return summary.failed > 0 ? 1 : 0;
+}
 
-        for (const auto &region: footprints["s_region"]) {
-            auto poly = load_region(region);
-            res.index.Add(std::make_unique<S2Polygon::Shape>(poly.get()));
-            res.polygons.push_back(std::move(poly));
+// `tesslocate xmatch <a.csv> <b.csv> <out.csv>`: pairs of stars from two
+// catalogs that lie within a radius of each other on at least one common FFI.
+int run_xmatch(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate xmatch", "Cross-match two catalogs on shared FFIs");
+    options.add_options()("a", "csv with columns ID, ra, dec", cxxopts::value<std::string>())(
+        "b", "csv with columns ID, ra, dec", cxxopts::value<std::string>())(
+        "output", "csv of matched pairs", cxxopts::value<std::string>())(
+        "radius", "match radius in arcseconds", cxxopts::value<double>()->default_value("60"))(
+        "threads", "number of worker threads (default: all cores)", cxxopts::value<int>());
+    options.parse_positional({"a", "b", "output"});
+    auto result = options.parse(argc, argv);
+    if (!result.count("a") || !result.count("b") || !result.count("output")) {
+        std::cerr << "usage: tesslocate xmatch <a.csv> <b.csv> <out.csv> [--radius arcsec]" << std::endl;
+        return 1;
+    }
+    for (const auto *key: {"a", "b"}) {
+        if (!std::filesystem::exists(result[key].as<std::string>())) {
+            std::cout << "File " << result[key].as<std::string>() << " does not exist." << std::endl;
+            return 1;
         }
+    }
+#ifdef USE_OPENMP
+    if (result.count("threads")) {
+        omp_set_num_threads(result["threads"].as<int>());
+    }
+#endif
 
-        return res;
+    std::vector<Catalog> catalogs;
+    for (const auto *key: {"a", "b"}) {
+        catalogs.push_back(read_catalog(result[key].as<std::string>()));
+        if (!catalogs.back().has_positions) {
+            std::cerr << result[key].as<std::string>() << " has no ra/dec columns." << std::endl;
+            return 1;
+        }
+        if (!catalogs.back().rejects.empty()) {
+            std::cerr << "Skipped " << catalogs.back().rejects.size() << " malformed rows in "
+                << result[key].as<std::string>() << "." << std::endl;
+        }
     }
+    const Catalog &a = catalogs[0], &b = catalogs[1];
+
+    // Only FFIs holding a row of A can be shared, so load just the footprints
+    // near it.
+    std::vector<S2Point> points(a.size());
+    for (size_t i = 0; i < a.size(); ++i) points[i] = radec_point(a.ra[i], a.dec[i]);
+    const S2CellUnion covering = catalog_covering(points);
+    json footprints = load_footprints();
+    IndexedPolygons index = IndexedPolygons::build(footprints, IndexedPolygons::tuned_options(footprints),
+                                                   &covering);
+    footprints = json();
+    index.force_build();
+
+    const auto matches = cross_match(a, b, index, S1Angle::Degrees(result["radius"].as<double>() / 3600));
+    write_cross_matches(result["output"].as<std::string>(), a, b, matches, index);
+    std::cout << "Wrote " << matches.size() << " pairs to " << result["output"].as<std::string>() << "."
+        << std::endl;
+    return 0;
+}
 
-    std::vector<std::string> search(const S2Point &point) {
-        std::vector<std::string> res;
-        auto query = S2ContainsPointQuery(&this->index);
-        query.VisitContainingShapes(point, [this, &res](const auto &shape) {
-            res.emplace_back(this->names[shape->id()]);
-            return true;
-        });
+// `tesslocate query --ra <ra> --dec <dec>`: look up single positions with low
+// latency. Without --ra and --dec, positions are read from stdin as one
+// "ra dec" pair per line, so an interactive session builds the index once.
+int run_query(int argc, char *argv[]) {
+    cxxopts::Options options("tesslocate query", "Look up single positions");
+    options.add_options()("ra", "right ascension in degrees", cxxopts::value<double>())(
+        "dec", "declination in degrees", cxxopts::value<double>())(
+        "shard-sectors", "sectors per sub-index searched in parallel (13 is about a year); 0 for one index",
+        cxxopts::value<int>()->default_value("13"))(
+        "threads", "threads searching the sub-indexes of one position (default: all cores)",
+        cxxopts::value<int>()->default_value("0"))(
+        "stats", "print query latencies to stderr, with sub-indexes compared against one combined index");
+    auto result = options.parse(argc, argv);
+    if (result.count("ra") != result.count("dec")) {
+        std::cerr << "usage: tesslocate query [--ra RA --dec DEC]" << std::endl;
+        return 1;
+    }
 
-        return res;
+    json footprints = load_footprints();
+    const auto index_options = IndexedPolygons::tuned_options(footprints);
+    const int shard_sectors = result["shard-sectors"].as<int>();
+    const bool stats = result.count("stats") > 0;
+    std::optional<ShardedIndex> sharded;
+    std::optional<IndexedPolygons> combined;
+    if (shard_sectors > 0) {
+        sharded.emplace(footprints, index_options, shard_sectors, result["threads"].as<int>());
+    }
+    // With --stats, sharded lookups are timed against the combined index too.
+    if (shard_sectors <= 0 || stats) {
+        combined.emplace(IndexedPolygons::build(footprints, index_options));
+        combined->force_build();
     }
-};
+    footprints = json();
+
+    auto micros_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    };
+    std::vector<double> latencies, combined_latencies;
+    auto query = [&](double ra, double dec) {
+        const S2Point point = radec_point(ra, dec);
+        std::vector<ObservationHandle> res;
+        auto start = std::chrono::steady_clock::now();
+        if (sharded) {
+            sharded->search(point, res);
+        } else {
+            combined->search(point, Engine::index, res);
+        }
+        latencies.push_back(micros_since(start));
+        if (sharded && stats) {
+            std::vector<ObservationHandle> baseline;
+            start = std::chrono::steady_clock::now();
+            combined->search(point, Engine::index, baseline);
+            combined_latencies.push_back(micros_since(start));
+        }
+        for (auto h: res) {
+            std::cout << ra << ',' << dec << ',' << (sharded ? sharded->name(h) : combined->name(h)) << '\n';
+        }
+        std::cout << std::flush;
+    };
 
-struct Target {
-    std::string ID;
-    double ra;
-    double dec;
-    std::vector<std::string> observations;
+    std::cout << "ra,dec,obs_id" << std::endl;
+    if (result.count("ra")) {
+        query(result["ra"].as<double>(), result["dec"].as<double>());
+    } else {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::istringstream fields(line);
+            double ra, dec;
+            if (!(fields >> ra >> dec)) {
+                std::cerr << "Expected \"ra dec\", got: " << line << std::endl;
+                continue;
+            }
+            query(ra, dec);
+        }
+    }
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(Target, ID, ra, dec, observations)
-};
+    auto print_latencies = [](const std::string &label, std::vector<double> &times) {
+        std::sort(times.begin(), times.end());
+        double total = 0;
+        for (double t: times) total += t;
+        std::cerr << label << ": " << times.size() << " queries, latency us: mean " << total / times.size() <<
+            ", p50 " << times[times.size() / 2] << ", p99 " << times[times.size() * 99 / 100] << ", max " <<
+            times.back() << std::endl;
+    };
+    if (stats && !latencies.empty()) {
+        if (sharded) {
+            print_latencies(std::to_string(sharded->shard_count()) + " sub-indexes", latencies);
+            print_latencies("combined index", combined_latencies);
+        } else {
+            print_latencies("combined index", latencies);
+        }
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "tune") {
+        return run_tune(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "tic-index") {
+        return run_tic_index(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "catalog") {
+        return run_catalog(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "lookup") {
+        return run_lookup(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "cutout") {
+        return run_cutout(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "xmatch") {
+        return run_xmatch(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "query") {
+        return run_query(argc - 1, argv + 1);
+    }
+
     cxxopts::Options options("tesslocate", "Locate targets on TESS FFIs");
-    options.add_options()("input", "path to csv with columns ID, ra, dec", cxxopts::value<std::string>())(
-        "output", "output file path, either json or csv", cxxopts::value<std::string>());
+    options.add_options()("input",
+                          "path to csv with columns ID, ra, dec (or only ID, see tic-index), a compiled .tcat "
+                          "catalog, or a directory of HEALPix-partitioned csv files", cxxopts::value<std::string>())(
+        "output", "output file path: json, csv, or cube for a targets by sectors matrix of uint8 camera/CCD codes",
+        cxxopts::value<std::string>())(
+        "threads", "number of worker threads (default: all cores)", cxxopts::value<int>())(
+        "engine", "lookup engine: auto, scan, index or cells", cxxopts::value<std::string>()->default_value("auto"))(
+        "reader", "input reader: auto, uring or mmap", cxxopts::value<std::string>()->default_value("auto"))(
+        "id-type", "how to carry IDs: auto (numeric when every ID is), string or u64",
+        cxxopts::value<std::string>()->default_value("auto"))(
+        "stats", "print the query plan and phase timings to stderr")(
+        "rejects", "where to write malformed input rows (default: next to the output)",
+        cxxopts::value<std::string>())(
+        "estimate", "estimate coverage from a sample of the input instead of a full run (no output file)")(
+        "precision", "with --estimate, target half-width of the confidence intervals",
+        cxxopts::value<double>()->default_value("0.01"))(
+        "max-sample", "with --estimate, the most rows to sample",
+        cxxopts::value<size_t>()->default_value("1000000"))(
+        "verify-sample", "re-check this fraction of rows against the reference index lookup",
+        cxxopts::value<double>())(
+        "verify-threshold", "with --verify-sample, fail when more than this fraction of checked rows mismatch",
+        cxxopts::value<double>()->default_value("0"))(
+        "lookup-index", "with csv output, also write a sidecar index for `tesslocate lookup`")(
+        "sets", "group targets by identical FFI sets: write a sets table and a set ID per target")(
+        "lazy", "only load footprints near the catalog (fast for small or localized catalogs)")(
+        "tic-index", "TIC index used to resolve ID-only input (default: in the cache directory)",
+        cxxopts::value<std::string>())(
+        "metrics-file", "write Prometheus metrics to this file during and after the run",
+        cxxopts::value<std::string>())(
+        "metrics-interval", "seconds between metrics file updates",
+        cxxopts::value<double>()->default_value("15"))(
+        "version", "print version information");
     options.parse_positional({"input", "output"});
     auto result = options.parse(argc, argv);
+    if (result.count("version")) {
+        print_version();
+        return 0;
+    }
     auto input = result["input"].as<std::string>();
-    auto output = result["output"].as<std::string>();
+#ifdef USE_OPENMP
+    if (result.count("threads")) {
+        omp_set_num_threads(result["threads"].as<int>());
+    }
+    const int threads = omp_get_max_threads();
+#else
+    const int threads = 1;
+#endif
+
+    std::optional<Engine> forced_engine;
+    if (result["engine"].as<std::string>() != "auto") {
+        forced_engine = parse_engine(result["engine"].as<std::string>());
+        if (!forced_engine) {
+            std::cerr << "Invalid engine: " << result["engine"].as<std::string>() << std::endl;
+            return 1;
+        }
+    }
+
+    auto reader_backend = parse_input_backend(result["reader"].as<std::string>());
+    if (!reader_backend) {
+        std::cerr << "Invalid reader: " << result["reader"].as<std::string>() << std::endl;
+        return 1;
+    }
+
+    auto id_type = parse_id_type(result["id-type"].as<std::string>());
+    if (!id_type) {
+        std::cerr << "Invalid ID type: " << result["id-type"].as<std::string>() << std::endl;
+        return 1;
+    }
 
     if (!std::filesystem::exists(input)) {
         std::cout << "File " << argv[1] << " does not exist." << std::endl;
         return 1;
     }
 
+    const bool partitioned = is_partitioned_catalog(input);
+    if (result.count("estimate")) {
+        if (partitioned || is_compiled_catalog(input)) {
+            std::cerr << "--estimate needs a single csv input, not a partitioned or compiled catalog." << std::endl;
+            return 1;
+        }
+        json footprints = load_footprints();
+        IndexedPolygons index = IndexedPolygons::build(footprints, IndexedPolygons::tuned_options(footprints));
+        footprints = json();
+        index.force_build();
+        EstimateOptions estimate_options;
+        estimate_options.precision = result["precision"].as<double>();
+        estimate_options.max_sample = result["max-sample"].as<size_t>();
+        estimate_options.seed = std::random_device{}();
+        print_estimate(std::cout, estimate_catalog(input, index, Engine::index, estimate_options));
+        return 0;
+    }
+
+    auto output = result["output"].as<std::string>();
     std::string format;
     if (output.substr(output.length() - 4, 4) == "json") {
         format = "json";
     } else if (output.substr(output.length() - 3, 3) == "csv") {
         format = "csv";
+    } else if (output.substr(output.length() - 4, 4) == "cube") {
+        format = "cube";
     } else {
         std::cerr << "Invalid output format." << std::endl;
         return 1;
     }
+    if (result.count("lookup-index") && format != "csv") {
+        std::cerr << "--lookup-index needs csv output." << std::endl;
+        return 1;
+    }
+    if (result.count("sets") && format == "cube") {
+        std::cerr << "--sets doesn't apply to cube output." << std::endl;
+        return 1;
+    }
 
-    IndexedPolygons index = IndexedPolygons::load();
-    csv::CSVReader reader(input);
-    std::vector<csv::CSVRow> rows;
-    for (const auto &row: reader) {
-        rows.push_back(row);
+    RunStats stats;
+    ThreadCounters counters(threads);
+    ProgressReporter reporter(stats, counters,
+                              result.count("metrics-file") ? result["metrics-file"].as<std::string>() : "",
+                              result["metrics-interval"].as<double>());
+    Catalog catalog;
+    // Stops the periodic metrics and writes the final ones, however the run ends.
+    auto finish_metrics = [&] {
+        reporter.finish();
+        stats.set("peak_rss_bytes", peak_rss_bytes());
+        if (result.count("metrics-file")) {
+            write_file_atomic(result["metrics-file"].as<std::string>(),
+                              prometheus_metrics(stats, counters, catalog.size(), false));
+        }
+    };
+    std::vector<Partition> partitions;
+    if (partitioned) {
+        // Only the partition list for now; which partitions are worth reading
+        // depends on the footprints.
+        partitions = list_partitions(input);
+        stats.set("reader", "partitioned");
+        stats.set("partitions", partitions.size());
+    } else if (is_compiled_catalog(input)) {
+        catalog = read_compiled_catalog(input);
+        stats.set("reader", "compiled");
+    } else {
+        InputBackend used_reader;
+        catalog = read_catalog(input, *reader_backend, &used_reader, *id_type);
+        stats.set("reader", input_backend_name(used_reader));
+    }
+    stats.end_phase("read_input");
+    auto report_rejects = [&] {
+        stats.set("id_type", catalog.numeric ? "u64" : "string");
+        stats.set("rejects", catalog.rejects.size());
+        if (catalog.rejects.empty()) return;
+        auto rejects = result.count("rejects") ? result["rejects"].as<std::string>() : rejects_path(output);
+        write_rejects(rejects, catalog.rejects);
+        std::cerr << "Skipped " << catalog.rejects.size() << " malformed rows; see " << rejects << "." << std::endl;
+        catalog.rejects = {};
+    };
+    if (!partitioned) report_rejects();
+
+    if (!catalog.has_positions) {
+        // ID-only input: look the positions up in the local TIC index.
+        auto tic_path = result.count("tic-index") ? result["tic-index"].as<std::string>() : default_tic_index_path();
+        if (!std::filesystem::exists(tic_path)) {
+            std::cerr << "Input has no ra/dec columns and no TIC index was found at " << tic_path <<
+                ". Build one with `tesslocate tic-index build`." << std::endl;
+            return 1;
+        }
+        TicIndex tic(tic_path);
+        const size_t unresolved = resolve_positions(catalog, tic);
+        if (unresolved > 0) {
+            std::cerr << "Skipped " << unresolved << " IDs not found in the TIC index." << std::endl;
+        }
+        stats.set("tic.unresolved", unresolved);
+        stats.end_phase("resolve_ids");
     }
 
-    std::vector<Target> results(rows.size());
-    std::atomic<int> current_iteration = 0;
+    std::optional<S2CellUnion> covering;
+    if (result.count("lazy") && partitioned) {
+        covering = partitions_covering(partitions);
+        stats.set("lazy.catalog_cells", covering->num_cells());
+    } else if (result.count("lazy")) {
+        std::vector<S2Point> points(catalog.size());
 #ifdef USE_OPENMP
 #pragma omp parallel for
 #endif
-    for (int i = 0; i < rows.size(); ++i) {
-        auto row = rows[i];
-        Target t;
-        t.ID = row["ID"].get<std::string>();
-        t.ra = row["ra"].get<double>();
-        t.dec = row["dec"].get<double>();
-        t.observations = index.search(radec_point(t.ra, t.dec));
-        results[i] = t;
-
-        ++current_iteration;
-        if (current_iteration % 100 == 0) {
+        for (int i = 0; i < catalog.size(); ++i) {
+            points[i] = radec_point(catalog.ra[i], catalog.dec[i]);
+        }
+        covering = catalog_covering(points);
+        stats.set("lazy.catalog_cells", covering->num_cells());
+    }
+    bool downloaded = false;
+    json footprints = load_footprints(&downloaded);
+    IndexedPolygons index = IndexedPolygons::build(footprints, IndexedPolygons::tuned_options(footprints),
+                                                   covering ? &*covering : nullptr);
+    std::vector<int> sectors;
+    if (format == "cube") {
+        sectors = cube_sectors(footprints);
+    }
+    footprints = json();
+    stats.set("footprint_cache", downloaded ? "download" : "hit");
+    stats.end_phase("load_footprints");
+
+    PartitionedCatalog partition_rows;
+    if (partitioned) {
+        index.force_build();
+        partition_rows = read_partitions(partitions, index, *reader_backend, *id_type);
+        catalog = std::move(partition_rows.catalog);
+        report_rejects();
+        stats.set("partitions.pruned", partition_rows.pruned);
+        stats.set("partitions.tagged", partition_rows.tagged);
+        stats.set("partitions.searched", partition_rows.searched);
+        stats.set("partitions.tagged_rows", partition_rows.tagged_rows);
+        stats.end_phase("read_partitions");
+    }
+
+    // A cheap, evenly spaced sample of positions tells the planner how the
+    // catalog spreads over the sky.
+    std::vector<S2Point> sample;
+    const size_t stride = std::max<size_t>(1, catalog.size() / 1024);
+    for (size_t i = 0; i < catalog.size(); i += stride) {
+        sample.push_back(radec_point(catalog.ra[i], catalog.dec[i]));
+    }
+    QueryPlan plan = plan_query(catalog.size(), sample, index.size(), threads);
+    if (forced_engine) {
+        plan.engine = *forced_engine;
+        plan.reason = "set with --engine";
+    }
+    stats.set("rows", catalog.size());
+    stats.set("footprints", index.size());
+    stats.set("threads", threads);
+    stats.set("plan.engine", engine_name(plan.engine));
+    stats.set("plan.reason", plan.reason);
+    stats.set("plan.spread", plan.spread);
+    stats.set("plan.chunk_size", plan.chunk_size);
+
+    std::optional<ShadowVerifier> verifier;
+    if (result.count("verify-sample")) {
+        verifier.emplace(index, result["verify-sample"].as<double>(), std::random_device{}(), threads);
+    }
+
+    // The reference path used by --verify-sample needs the index even for scans.
+    if (plan.engine != Engine::scan || verifier) {
+        index.force_build();
+    }
+    if (plan.engine == Engine::cells) {
+        index.build_cell_table(kCellTableLevel);
+    }
+    stats.end_phase("build_index");
+
+    const bool group_sets = result.count("sets") > 0;
+    ObservationSets sets;
+    std::vector<Target> results(catalog.size());
+    reporter.start_progress(catalog.size());
 #ifdef USE_OPENMP
-#pragma omp critical
-            std::cout << "\rProgress: " << current_iteration << "/" << rows.size();
+#pragma omp parallel for schedule(dynamic, plan.chunk_size)
 #endif
+    for (int i = 0; i < catalog.size(); ++i) {
+#ifdef USE_OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        // Compiled catalogs are walked in Hilbert order with the points
+        // already converted; results still land in input order.
+        const size_t row = catalog.compiled ? catalog.compiled->input_rows[i] : i;
+        Target t;
+        if (catalog.compiled && catalog.numeric) {
+            t.numeric_id = catalog.compiled->numeric_ids[i];
+        } else if (catalog.compiled) {
+            t.ID = catalog.compiled->id(i);
+        } else if (catalog.numeric) {
+            t.numeric_id = catalog.numeric_ids[i];
+        } else {
+            t.ID = std::move(catalog.ids[i]);
+        }
+        t.ra = catalog.ra[i];
+        t.dec = catalog.dec[i];
+        bool fast_path = false;
+        if (partitioned && partition_rows.tag[i] >= 0) {
+            // The row's partition lies inside the same footprints throughout.
+            t.observations = partition_rows.tags[partition_rows.tag[i]];
+        } else {
+            const S2Point point = catalog.compiled ? catalog.compiled->point(i) : radec_point(t.ra, t.dec);
+            if (plan.engine == Engine::index) {
+                fast_path = index.search_refined(point, t.observations);
+            } else {
+                index.search(point, plan.engine, t.observations);
+            }
+        }
+        counters.add(thread, 1, t.observations.size(), fast_path);
+        if (verifier && verifier->sampled(row)) {
+            char buf[32];
+            verifier->check(thread, row, std::string(t.id_text(buf)), t.ra, t.dec, t.observations);
         }
+        if (group_sets) {
+            std::sort(t.observations.begin(), t.observations.end());
+            t.set = sets.intern(t.observations);
+            t.observations = {};
+        }
+        results[row] = std::move(t);
     }
-    std::cout << std::endl;
-
-    if (format == "json") {
-        std::cout << "Writing results to json." << std::endl;
-        ojson j = results;
-        std::ofstream file(output);
-        file << j.dump(4);
-        std::cout << "Wrote results to " << output << "." << std::endl;
-        return 0;
+    stats.end_phase("query");
+    // Metrics keep being written while the results are; only the progress line ends here.
+    reporter.end_progress();
+    if (plan.engine == Engine::index && catalog.size() > 0) {
+        stats.set("index.fast_path", static_cast<double>(counters.fast_path()) / catalog.size());
     }
 
-    if (format == "csv") {
-        std::cout << "Writing results to csv." << std::endl;
-        std::ofstream file(output);
-        file << "ID,ra,dec,sector,camera,ccd" << std::endl;
-        for (const auto &t: results) {
-            for (const auto &obs: t.observations) {
-                file << t.ID << "," << t.ra << "," << t.dec << "," <<
-                    std::stoi(obs.substr(6, 4)) << "," << obs.substr(11, 1) << "," << obs.substr(13, 1) << std::endl;
+    if (verifier) {
+        const size_t checked = verifier->checked();
+        const size_t mismatches = verifier->mismatches().size();
+        stats.set("verify.checked", checked);
+        stats.set("verify.mismatches", mismatches);
+        verifier->report(std::cerr);
+        if (mismatches > result["verify-threshold"].as<double>() * checked) {
+            std::cerr << "Verification failed; not writing results." << std::endl;
+            finish_metrics();
+            if (result.count("stats")) {
+                stats.print(std::cerr);
             }
+            return 1;
         }
+    }
 
-        std::cout << "Wrote results to " << output << "." << std::endl;
-        return 0;
+    std::cout << "Writing results to " << format << "." << std::endl;
+    std::vector<LookupEntry> lookup;
+    auto *lookup_ptr = result.count("lookup-index") ? &lookup : nullptr;
+    if (group_sets) {
+        const auto set_table = sets.finish(results);
+        stats.set("sets", set_table.size());
+        if (format == "json") {
+            write_json_sets(output, results, set_table, index);
+        } else {
+            write_csv_sets(output, results, set_table, index, lookup_ptr);
+        }
+    } else if (format == "json") {
+        write_json(output, results, index);
+    } else if (format == "cube") {
+        write_cube(output, results, index, sectors);
+        std::cout << "Wrote the cube's sectors to " << cube_sectors_path(output) << " and targets to "
+            << cube_targets_path(output) << "." << std::endl;
+    } else {
+        write_csv(output, results, index, lookup_ptr);
     }
+    if (lookup_ptr) {
+        write_lookup_index(lookup_index_path(output), lookup);
+    }
+    std::cout << "Wrote results to " << output << "." << std::endl;
+    stats.end_phase("write_output");
+    finish_metrics();
 
+    if (result.count("stats")) {
+        stats.print(std::cerr);
+    }
     return 0;
 }
@@ -0,0 +1,192 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+void RunStats::print(std::ostream &out) const {
+    std::lock_guard lock(this->mutex);
+    for (const auto &[name, value]: this->values) {
+        out << name << ": " << value << "\n";
+    }
+    double total = 0;
+    for (const auto &[name, seconds]: this->phases) {
+        out << "time." << name << ": " << seconds << " s\n";
+        total += seconds;
+    }
+    out << "time.total: " << total << " s" << std::endl;
+}
+
+uint64_t peak_rss_bytes() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss; // bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+}
+
+// Escapes a Prometheus label value.
+static std::string label(const std::string &value) {
+    std::string res;
+    for (char c: value) {
+        if (c == '\\' || c == '"') res += '\\';
+        if (c == '\n') {
+            res += "\\n";
+            continue;
+        }
+        res += c;
+    }
+    return res;
+}
+
+std::string prometheus_metrics(const RunStats &stats, const ThreadCounters &counters, uint64_t total_rows,
+                               bool in_progress) {
+    std::ostringstream out;
+    out.precision(9);
+    auto metric = [&out](const char *name, const char *type, const char *help) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    };
+
+    metric("tesslocate_info", "gauge", "Run configuration.");
+    out << "tesslocate_info{engine=\"" << label(stats.get("plan.engine").value_or("")) << "\",threads=\"" <<
+        label(stats.get("threads").value_or("")) << "\"} 1\n";
+
+    metric("tesslocate_run_in_progress", "gauge", "1 while the run is in progress, 0 once it has finished.");
+    out << "tesslocate_run_in_progress " << (in_progress ? 1 : 0) << "\n";
+
+    metric("tesslocate_last_update_timestamp_seconds", "gauge", "Time the metrics were written.");
+    out << "tesslocate_last_update_timestamp_seconds " <<
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+        << "\n";
+
+    metric("tesslocate_input_rows", "gauge", "Rows in the input catalog.");
+    out << "tesslocate_input_rows " << total_rows << "\n";
+
+    const uint64_t rows = counters.rows();
+    metric("tesslocate_rows_processed_total", "counter", "Catalog rows queried so far.");
+    out << "tesslocate_rows_processed_total " << rows << "\n";
+
+    metric("tesslocate_hits_total", "counter", "Target-FFI matches found so far.");
+    out << "tesslocate_hits_total " << counters.hits() << "\n";
+
+    metric("tesslocate_fast_path_rows_total", "counter",
+           "Rows answered from an index cell's footprint list without an exact test.");
+    out << "tesslocate_fast_path_rows_total " << counters.fast_path() << "\n";
+
+    const auto phases = stats.completed_phases();
+    metric("tesslocate_phase_duration_seconds", "gauge", "Wall time of each completed phase.");
+    double query_seconds = -1, build_seconds = -1;
+    for (const auto &[name, seconds]: phases) {
+        out << "tesslocate_phase_duration_seconds{phase=\"" << label(name) << "\"} " << seconds << "\n";
+        if (name == "query") query_seconds = seconds;
+        if (name == "build_index") build_seconds = seconds;
+    }
+    if (build_seconds >= 0) {
+        metric("tesslocate_index_build_seconds", "gauge", "Time spent building the footprint index.");
+        out << "tesslocate_index_build_seconds " << build_seconds << "\n";
+    }
+
+    // During the query phase the rate is measured against its elapsed time.
+    if (query_seconds < 0 && rows > 0) query_seconds = stats.current_phase_seconds();
+    metric("tesslocate_rows_per_second", "gauge", "Query throughput.");
+    out << "tesslocate_rows_per_second " << (query_seconds > 0 ? rows / query_seconds : 0.0) << "\n";
+
+    metric("tesslocate_peak_rss_bytes", "gauge", "Peak resident set size.");
+    out << "tesslocate_peak_rss_bytes " << peak_rss_bytes() << "\n";
+
+    if (auto checked = stats.get("verify.checked")) {
+        metric("tesslocate_verify_checked_rows", "gauge", "Rows re-checked against the reference lookup.");
+        out << "tesslocate_verify_checked_rows " << *checked << "\n";
+        metric("tesslocate_verify_mismatches", "gauge", "Re-checked rows whose FFIs differed from the reference.");
+        out << "tesslocate_verify_mismatches " << stats.get("verify.mismatches").value_or("0") << "\n";
+    }
+
+    if (auto cache = stats.get("footprint_cache")) {
+        metric("tesslocate_footprint_cache_hit", "gauge", "1 if the footprint cache was used, 0 if downloaded.");
+        out << "tesslocate_footprint_cache_hit " << (*cache == "hit" ? 1 : 0) << "\n";
+    }
+    return out.str();
+}
+
+void write_file_atomic(const std::string &path, const std::string &text) {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open " + tmp);
+        }
+        file << text;
+        if (!file) {
+            throw std::runtime_error("Failed to write " + tmp);
+        }
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+ProgressReporter::ProgressReporter(const RunStats &stats, const ThreadCounters &counters, std::string metrics_path,
+                                   double interval_seconds)
+    : stats(stats), counters(counters), metrics_path(std::move(metrics_path)), interval(interval_seconds),
+      thread(&ProgressReporter::run, this) {}
+
+ProgressReporter::~ProgressReporter() {
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    if (this->thread.joinable()) this->thread.join();
+}
+
+void ProgressReporter::start_progress(uint64_t total) {
+    this->total_rows = total;
+    this->show_progress = true;
+}
+
+void ProgressReporter::run() {
+    using clock = std::chrono::steady_clock;
+    const auto tick = std::chrono::milliseconds(200);
+    auto next_metrics = clock::now() + this->interval;
+
+    std::unique_lock lock(this->mutex);
+    while (!this->stopping) {
+        this->wake.wait_for(lock, tick);
+        if (this->stopping) break;
+
+        if (this->show_progress) {
+            std::cout << "\rProgress: " << this->counters.rows() << "/" << this->total_rows << std::flush;
+        }
+        if (!this->metrics_path.empty() && clock::now() >= next_metrics) {
+            try {
+                write_file_atomic(this->metrics_path,
+                                  prometheus_metrics(this->stats, this->counters, this->total_rows, true));
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+            }
+            next_metrics = clock::now() + this->interval;
+        }
+    }
+}
+
+void ProgressReporter::end_progress() {
+    // Under the lock, so the line isn't printed twice.
+    std::lock_guard lock(this->mutex);
+    if (this->show_progress) {
+        std::cout << "\rProgress: " << this->counters.rows() << "/" << this->total_rows << std::endl;
+        this->show_progress = false;
+    }
+}
+
+void ProgressReporter::finish() {
+    this->end_progress();
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    if (this->thread.joinable()) this->thread.join();
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Per-thread counters. Each worker only writes its own cache-line-sized slot,
+// so counting costs a couple of uncontended stores; readers sum the slots.
+class ThreadCounters {
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> rows{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> fast_path{0};
+    };
+
+    std::vector<Slot> slots;
+
+public:
+    explicit ThreadCounters(int threads) : slots(std::max(1, threads)) {}
+
+    // Only called by the thread that owns the slot. fast_path counts rows
+    // answered without an exact point-in-polygon test.
+    void add(int thread, uint64_t rows, uint64_t hits, uint64_t fast_path = 0) {
+        auto &slot = this->slots[thread];
+        slot.rows.store(slot.rows.load(std::memory_order_relaxed) + rows, std::memory_order_relaxed);
+        slot.hits.store(slot.hits.load(std::memory_order_relaxed) + hits, std::memory_order_relaxed);
+        slot.fast_path.store(slot.fast_path.load(std::memory_order_relaxed) + fast_path, std::memory_order_relaxed);
+    }
+
+    uint64_t rows() const {
+        uint64_t total = 0;
+        for (const auto &slot: this->slots) total += slot.rows.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t hits() const {
+        uint64_t total = 0;
+        for (const auto &slot: this->slots) total += slot.hits.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t fast_path() const {
+        uint64_t total = 0;
+        for (const auto &slot: this->slots) total += slot.fast_path.load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// Wall time of each phase of a run plus values describing it, such as the
+// planner's decision. Printed with --stats and exported with --metrics-file.
+class RunStats {
+    using clock = std::chrono::steady_clock;
+    mutable std::mutex mutex;
+    clock::time_point phase_start = clock::now();
+    std::vector<std::pair<std::string, double> > phases;
+    std::vector<std::pair<std::string, std::string> > values;
+
+public:
+    // Ends the phase that started at the previous call (or construction).
+    void end_phase(const std::string &name) {
+        std::lock_guard lock(this->mutex);
+        auto now = clock::now();
+        this->phases.emplace_back(name, std::chrono::duration<double>(now - this->phase_start).count());
+        this->phase_start = now;
+    }
+
+    template<typename T>
+    void set(const std::string &name, const T &value) {
+        std::ostringstream ss;
+        ss << value;
+        std::lock_guard lock(this->mutex);
+        this->values.emplace_back(name, ss.str());
+    }
+
+    std::optional<std::string> get(const std::string &name) const {
+        std::lock_guard lock(this->mutex);
+        for (const auto &[key, value]: this->values) {
+            if (key == name) return value;
+        }
+        return std::nullopt;
+    }
+
+    std::vector<std::pair<std::string, double> > completed_phases() const {
+        std::lock_guard lock(this->mutex);
+        return this->phases;
+    }
+
+    // Seconds since the last completed phase ended.
+    double current_phase_seconds() const {
+        std::lock_guard lock(this->mutex);
+        return std::chrono::duration<double>(clock::now() - this->phase_start).count();
+    }
+
+    void print(std::ostream &out) const;
+};
+
+// Peak resident set size of this process.
+uint64_t peak_rss_bytes();
+
+// Renders the run in the Prometheus text exposition format.
+std::string prometheus_metrics(const RunStats &stats, const ThreadCounters &counters, uint64_t total_rows,
+                               bool in_progress);
+
+// Replaces path with text atomically (temp file + rename), so the
+// node_exporter textfile collector never sees a partial file.
+void write_file_atomic(const std::string &path, const std::string &text);
+
+// Background thread that prints query progress and, given a metrics path,
+// rewrites the metrics file every interval. Keeps both off the query loop.
+class ProgressReporter {
+    const RunStats &stats;
+    const ThreadCounters &counters;
+    std::string metrics_path;
+    std::chrono::duration<double> interval;
+    std::atomic<uint64_t> total_rows{0};
+    std::atomic<bool> show_progress{false};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+
+    void run();
+
+public:
+    ProgressReporter(const RunStats &stats, const ThreadCounters &counters, std::string metrics_path,
+                     double interval_seconds);
+    ~ProgressReporter();
+
+    // Starts printing "Progress: done/total" for the query phase.
+    void start_progress(uint64_t total);
+
+    // Prints the final progress line and stops printing progress. Metrics are
+    // still written every interval until finish().
+    void end_progress();
+
+    // Stops the thread, after end_progress() if that wasn't called. The
+    // caller writes the final metrics once the run is complete.
+    void finish();
+};
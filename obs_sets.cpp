@@ -0,0 +1,54 @@
+#include "obs_sets.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+size_t ObservationSets::Hash::operator()(const std::vector<ObservationHandle> &handles) const {
+    // FNV-1a over the handles, finished with a multiply so the shard bits mix.
+    uint64_t hash = 14695981039346656037ULL;
+    for (ObservationHandle h: handles) {
+        hash ^= static_cast<uint32_t>(h);
+        hash *= 1099511628211ULL;
+    }
+    return hash * 0x9E3779B97F4A7C15ULL;
+}
+
+int ObservationSets::intern(const std::vector<ObservationHandle> &handles) {
+    const size_t hash = Hash{}(handles);
+    auto &shard = this->shards[hash >> 58 & (kShards - 1)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.ids.find(handles);
+    if (it != shard.ids.end()) return it->second;
+    const int id = this->next_id.fetch_add(1);
+    shard.ids.emplace(handles, id);
+    return id;
+}
+
+std::vector<std::vector<ObservationHandle> > ObservationSets::finish(std::vector<Target> &results) {
+    std::vector<std::vector<ObservationHandle> > by_id(this->size());
+    for (auto &shard: this->shards) {
+        for (auto &[handles, id]: shard.ids) {
+            by_id[id] = handles;
+        }
+        shard.ids.clear();
+    }
+
+    std::vector<int> remap(by_id.size(), -1);
+    std::vector<std::vector<ObservationHandle> > res;
+    res.reserve(by_id.size());
+    for (const auto &t: results) {
+        if (remap[t.set] < 0) {
+            remap[t.set] = static_cast<int>(res.size());
+            res.push_back(std::move(by_id[t.set]));
+        }
+    }
+
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int64_t i = 0; i < static_cast<int64_t>(results.size()); ++i) {
+        results[i].set = remap[results[i].set];
+    }
+    return res;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "output.h"
+
+// Interns the distinct sets of FFIs that targets fall on. In dense fields many
+// neighbouring targets share exactly the same set, so each set is stored once
+// and targets refer to it by ID. Safe to call intern() from the query loop;
+// the table is split into shards, each with its own lock.
+class ObservationSets {
+    struct Hash {
+        size_t operator()(const std::vector<ObservationHandle> &handles) const;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::vector<ObservationHandle>, int, Hash> ids;
+    };
+
+    static constexpr size_t kShards = 64;
+    std::array<Shard, kShards> shards;
+    std::atomic<int> next_id{0};
+
+public:
+    // Returns the ID of the set. handles must be sorted.
+    int intern(const std::vector<ObservationHandle> &handles);
+
+    size_t size() const {
+        return this->next_id.load();
+    }
+
+    // Renumbers the sets in order of first appearance in results, so the
+    // output doesn't depend on thread scheduling, updates each target's set
+    // ID and returns the sets indexed by the new IDs.
+    std::vector<std::vector<ObservationHandle> > finish(std::vector<Target> &results);
+};
@@ -0,0 +1,459 @@
+#include "output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+using ojson = nlohmann::ordered_json;
+
+// Targets per formatting chunk.
+constexpr size_t kChunkTargets = 4096;
+
+static int max_threads() {
+#ifdef USE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// An output file written at explicit offsets from several threads.
+class PositionalFile {
+    int fd;
+    std::string path;
+
+public:
+    explicit PositionalFile(const std::string &path) : path(path) {
+        this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (this->fd < 0) {
+            throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    ~PositionalFile() {
+        if (this->fd >= 0) close(this->fd);
+    }
+
+    PositionalFile(const PositionalFile &) = delete;
+    PositionalFile &operator=(const PositionalFile &) = delete;
+
+    // Reserves the final size so concurrent writes never extend the file.
+    void allocate(size_t size) {
+#ifdef __linux__
+        if (fallocate(this->fd, 0, 0, static_cast<off_t>(size)) == 0) return;
+#endif
+        if (ftruncate(this->fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("Failed to allocate " + this->path + ": " + std::strerror(errno));
+        }
+    }
+
+    void write_at(const std::string &data, size_t offset) {
+        size_t done = 0;
+        while (done < data.size()) {
+            const ssize_t n = pwrite(this->fd, data.data() + done, data.size() - done,
+                                     static_cast<off_t>(offset + done));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to write " + this->path + ": " + std::strerror(errno));
+            }
+            done += n;
+        }
+    }
+
+    void close_file() {
+        if (close(this->fd) != 0) {
+            this->fd = -1;
+            throw std::runtime_error("Failed to write " + this->path + ": " + std::strerror(errno));
+        }
+        this->fd = -1;
+    }
+};
+
+// Formats ra and dec the way an ostream does by default (printf's %g).
+static size_t format_double(char *buf, double value) {
+    return std::to_chars(buf, buf + 32, value, std::chars_format::general, 6).ptr - buf;
+}
+
+// ",sector,camera,ccd\n" for every footprint, parsed once from its obs_id.
+static std::vector<std::string> csv_suffixes(const IndexedPolygons &index) {
+    std::vector<std::string> res(index.size());
+    for (size_t i = 0; i < index.size(); ++i) {
+        const auto &obs = index.name(static_cast<ObservationHandle>(i));
+        res[i] = "," + std::to_string(std::stoi(obs.substr(6, 4))) + "," + obs.substr(11, 1) + "," +
+            obs.substr(13, 1) + "\n";
+    }
+    return res;
+}
+
+// The "ID,ra,dec" part shared by all of a target's rows.
+static size_t csv_prefix(char *buf, const Target &t, std::string &prefix) {
+    prefix = t.id_text(buf);
+    prefix += ',';
+    prefix.append(buf, format_double(buf, t.ra));
+    prefix += ',';
+    prefix.append(buf, format_double(buf, t.dec));
+    return prefix.size();
+}
+
+// Appends text with every line indented, which is how dump(4) renders a
+// value nested inside a container.
+static void append_indented(std::string &out, const std::string &text, const char *indent) {
+    out += indent;
+    for (char c: text) {
+        out += c;
+        if (c == '\n') out += indent;
+    }
+}
+
+// Runs format(first, last, buffer) over windows of chunks in parallel and
+// writes each window at the running offset. Returns the total size. If
+// chunk_offsets is given, it receives the file offset of every chunk.
+template<typename Format>
+static size_t write_chunks(PositionalFile &file, size_t offset, size_t targets, Format format,
+                           std::vector<size_t> *chunk_offsets = nullptr) {
+    const size_t chunks = (targets + kChunkTargets - 1) / kChunkTargets;
+    if (chunk_offsets) chunk_offsets->clear();
+    const size_t window = static_cast<size_t>(max_threads()) * 4;
+    std::vector<std::string> buffers(window);
+    std::vector<size_t> offsets(window);
+
+    for (size_t first = 0; first < chunks; first += window) {
+        const int64_t count = static_cast<int64_t>(std::min(window, chunks - first));
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int64_t c = 0; c < count; ++c) {
+            const size_t begin = (first + c) * kChunkTargets;
+            buffers[c].clear();
+            format(begin, std::min(targets, begin + kChunkTargets), buffers[c]);
+        }
+
+        for (int64_t c = 0; c < count; ++c) {
+            offsets[c] = offset;
+            offset += buffers[c].size();
+        }
+        if (chunk_offsets) chunk_offsets->insert(chunk_offsets->end(), offsets.begin(), offsets.begin() + count);
+
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int64_t c = 0; c < count; ++c) {
+            file.write_at(buffers[c], offsets[c]);
+        }
+    }
+    return offset;
+}
+
+// Turns chunk-relative entries, one per target slot, into file offsets and
+// drops the slots of targets that wrote nothing.
+static void place_lookup_entries(std::vector<LookupEntry> &entries, const std::vector<size_t> &chunk_offsets) {
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].length == 0) continue;
+        entries[kept] = entries[i];
+        entries[kept].offset += chunk_offsets[i / kChunkTargets];
+        ++kept;
+    }
+    entries.resize(kept);
+}
+
+void write_csv(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index,
+               std::vector<LookupEntry> *lookup) {
+    static const std::string header = "ID,ra,dec,sector,camera,ccd\n";
+    const auto suffixes = csv_suffixes(index);
+
+    // Exact size of the output, so the file can be allocated before writing.
+    size_t size = header.size();
+#ifdef USE_OPENMP
+#pragma omp parallel for reduction(+:size)
+#endif
+    for (int64_t i = 0; i < static_cast<int64_t>(results.size()); ++i) {
+        const auto &t = results[i];
+        if (t.observations.empty()) continue;
+        char buf[32];
+        const size_t prefix = t.id_text(buf).size() + 2 + format_double(buf, t.ra) + format_double(buf, t.dec);
+        for (const auto &handle: t.observations) {
+            size += prefix + suffixes[handle].size();
+        }
+    }
+
+    if (lookup) lookup->assign(results.size(), LookupEntry{});
+    std::vector<size_t> chunk_offsets;
+    PositionalFile file(path);
+    file.allocate(size);
+    file.write_at(header, 0);
+    write_chunks(file, header.size(), results.size(), [&](size_t first, size_t last, std::string &out) {
+        char buf[32];
+        std::string prefix;
+        for (size_t i = first; i < last; ++i) {
+            const auto &t = results[i];
+            if (t.observations.empty()) continue;
+            const size_t begin = out.size();
+            csv_prefix(buf, t, prefix);
+            for (const auto &handle: t.observations) {
+                out += prefix;
+                out += suffixes[handle];
+            }
+            if (lookup) (*lookup)[i] = {lookup_hash(t.id_text(buf)), begin, out.size() - begin};
+        }
+    }, lookup ? &chunk_offsets : nullptr);
+    file.close_file();
+    if (lookup) place_lookup_entries(*lookup, chunk_offsets);
+}
+
+void write_json(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index) {
+    PositionalFile file(path);
+    if (results.empty()) {
+        file.write_at("[]", 0);
+        file.close_file();
+        return;
+    }
+
+    // Each element is dumped on its own and indented one level, which is
+    // exactly how dump(4) renders it inside the enclosing array.
+    file.write_at("[\n", 0);
+    size_t end = write_chunks(file, 2, results.size(), [&](size_t first, size_t last, std::string &out) {
+        char buf[32];
+        for (size_t i = first; i < last; ++i) {
+            const auto &t = results[i];
+            ojson observations = ojson::array();
+            for (const auto &handle: t.observations) {
+                observations.push_back(index.name(handle));
+            }
+            ojson element = {{"ID", t.id_text(buf)}, {"ra", t.ra}, {"dec", t.dec}, {"observations", observations}};
+
+            append_indented(out, element.dump(4), "    ");
+            out += i + 1 < results.size() ? ",\n" : "\n";
+        }
+    });
+    file.write_at("]", end);
+    file.close_file();
+}
+
+std::string sidecar_path(const std::string &path, const char *suffix) {
+    const auto dot = path.rfind('.');
+    return (dot == std::string::npos ? path : path.substr(0, dot)) + suffix;
+}
+
+std::string sets_csv_path(const std::string &path) {
+    return sidecar_path(path, ".sets.csv");
+}
+
+void write_csv_sets(const std::string &path, const std::vector<Target> &results,
+                    const std::vector<std::vector<ObservationHandle> > &sets, const IndexedPolygons &index,
+                    std::vector<LookupEntry> *lookup) {
+    const auto suffixes = csv_suffixes(index);
+    {
+        std::string table = "set,sector,camera,ccd\n";
+        for (size_t s = 0; s < sets.size(); ++s) {
+            const auto id = std::to_string(s);
+            for (const auto &handle: sets[s]) {
+                table += id;
+                table += suffixes[handle];
+            }
+        }
+        PositionalFile file(sets_csv_path(path));
+        file.write_at(table, 0);
+        file.close_file();
+    }
+
+    static const std::string header = "ID,ra,dec,set\n";
+    if (lookup) lookup->assign(results.size(), LookupEntry{});
+    std::vector<size_t> chunk_offsets;
+    PositionalFile file(path);
+    file.write_at(header, 0);
+    write_chunks(file, header.size(), results.size(), [&](size_t first, size_t last, std::string &out) {
+        char buf[32];
+        std::string prefix;
+        for (size_t i = first; i < last; ++i) {
+            const auto &t = results[i];
+            if (sets[t.set].empty()) continue;
+            const size_t begin = out.size();
+            csv_prefix(buf, t, prefix);
+            out += prefix;
+            out += ',';
+            out.append(buf, std::to_chars(buf, buf + sizeof(buf), t.set).ptr - buf);
+            out += '\n';
+            if (lookup) (*lookup)[i] = {lookup_hash(t.id_text(buf)), begin, out.size() - begin};
+        }
+    }, lookup ? &chunk_offsets : nullptr);
+    file.close_file();
+    if (lookup) place_lookup_entries(*lookup, chunk_offsets);
+}
+
+void write_json_sets(const std::string &path, const std::vector<Target> &results,
+                     const std::vector<std::vector<ObservationHandle> > &sets, const IndexedPolygons &index) {
+    ojson table = ojson::array();
+    for (const auto &set: sets) {
+        ojson names = ojson::array();
+        for (const auto &handle: set) {
+            names.push_back(index.name(handle));
+        }
+        table.push_back(std::move(names));
+    }
+
+    // Laid out the way dump(4) renders the whole object.
+    std::string head = "{\n    \"sets\": ";
+    head += table.dump(4);
+    for (size_t pos = head.find('\n', 2); pos != std::string::npos; pos = head.find('\n', pos + 1)) {
+        head.insert(pos + 1, "    ");
+    }
+    head += results.empty() ? ",\n    \"targets\": []" : ",\n    \"targets\": [\n";
+
+    PositionalFile file(path);
+    file.write_at(head, 0);
+    size_t end = write_chunks(file, head.size(), results.size(), [&](size_t first, size_t last, std::string &out) {
+        char buf[32];
+        for (size_t i = first; i < last; ++i) {
+            const auto &t = results[i];
+            ojson element = {{"ID", t.id_text(buf)}, {"ra", t.ra}, {"dec", t.dec}, {"set", t.set}};
+            append_indented(out, element.dump(4), "        ");
+            out += i + 1 < results.size() ? ",\n" : "\n";
+        }
+    });
+    file.write_at(results.empty() ? "\n}" : "    ]\n}", end);
+    file.close_file();
+}
+
+std::string cube_sectors_path(const std::string &path) {
+    return sidecar_path(path, ".sectors.csv");
+}
+
+std::string cube_targets_path(const std::string &path) {
+    return sidecar_path(path, ".targets.csv");
+}
+
+std::vector<int> cube_sectors(const json &footprints) {
+    std::vector<int> sectors;
+    for (const auto &obs: footprints["obs_id"]) {
+        sectors.push_back(std::stoi(obs.get_ref<const std::string &>().substr(6, 4)));
+    }
+    std::sort(sectors.begin(), sectors.end());
+    sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+    return sectors;
+}
+
+void write_cube(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index,
+                const std::vector<int> &sectors) {
+    // Every footprint's column and cell value, parsed once from its obs_id.
+    std::vector<uint32_t> footprint_column(index.size());
+    std::vector<uint8_t> footprint_value(index.size());
+    for (size_t i = 0; i < index.size(); ++i) {
+        const auto &obs = index.name(static_cast<ObservationHandle>(i));
+        const int sector = std::stoi(obs.substr(6, 4));
+        const auto column = std::lower_bound(sectors.begin(), sectors.end(), sector);
+        if (column == sectors.end() || *column != sector) {
+            throw std::runtime_error("Footprint " + obs + " is in none of the cube's sectors");
+        }
+        footprint_column[i] = column - sectors.begin();
+        footprint_value[i] = static_cast<uint8_t>((obs[11] - '1') * 4 + (obs[13] - '0'));
+    }
+
+    {
+        std::string table = "column,sector\n";
+        for (size_t c = 0; c < sectors.size(); ++c) {
+            table += std::to_string(c) + "," + std::to_string(sectors[c]) + "\n";
+        }
+        PositionalFile file(cube_sectors_path(path));
+        file.write_at(table, 0);
+        file.close_file();
+    }
+    {
+        static const std::string header = "ID,ra,dec\n";
+        PositionalFile file(cube_targets_path(path));
+        file.write_at(header, 0);
+        write_chunks(file, header.size(), results.size(), [&](size_t first, size_t last, std::string &out) {
+            char buf[32];
+            std::string prefix;
+            for (size_t i = first; i < last; ++i) {
+                csv_prefix(buf, results[i], prefix);
+                out += prefix;
+                out += '\n';
+            }
+        });
+        file.close_file();
+    }
+
+    // The file starts out all zeros, so threads only touch the cells of
+    // their own rows that were observed.
+    const size_t columns = sectors.size();
+    const size_t size = results.size() * columns;
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+    int failed = 0;
+#ifdef __linux__
+    failed = size > 0 ? fallocate(fd, 0, 0, static_cast<off_t>(size)) : 0;
+#endif
+    if (failed != 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        const int error = errno;
+        close(fd);
+        throw std::runtime_error("Failed to allocate " + path + ": " + std::strerror(error));
+    }
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        const int error = errno;
+        close(fd);
+        throw std::runtime_error("Failed to map " + path + ": " + std::strerror(error));
+    }
+    auto *cells = static_cast<uint8_t *>(map);
+
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int64_t i = 0; i < static_cast<int64_t>(results.size()); ++i) {
+        uint8_t *row = cells + i * columns;
+        for (const auto &handle: results[i].observations) {
+            // A target on the edge of two CCDs in one sector keeps the lower one.
+            uint8_t &cell = row[footprint_column[handle]];
+            if (cell == 0 || footprint_value[handle] < cell) cell = footprint_value[handle];
+        }
+    }
+
+    int error = msync(map, size, MS_SYNC) == 0 ? 0 : errno;
+    munmap(map, size);
+    if (close(fd) != 0 && error == 0) error = errno;
+    if (error != 0) {
+        throw std::runtime_error("Failed to write " + path + ": " + std::strerror(error));
+    }
+}
+
+std::string rejects_path(const std::string &path) {
+    return sidecar_path(path, ".rejects.csv");
+}
+
+void write_rejects(const std::string &path, const std::vector<RejectedRow> &rejects) {
+    static const std::string header = "row,reason,text\n";
+    PositionalFile file(path);
+    file.write_at(header, 0);
+    write_chunks(file, header.size(), rejects.size(), [&](size_t first, size_t last, std::string &out) {
+        for (size_t i = first; i < last; ++i) {
+            const auto &r = rejects[i];
+            out += std::to_string(r.row);
+            out += ',';
+            out += row_status_reason(r.status);
+            out += ",\"";
+            for (char c: r.text) {
+                if (c == '"') out += '"';
+                out += c;
+            }
+            out += "\"\n";
+        }
+    });
+    file.close_file();
+}
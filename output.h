@@ -0,0 +1,74 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "locator.h"
+#include "catalog.h"
+#include "lookup.h"
+
+struct Target {
+    // Empty for numeric catalogs, whose IDs are in numeric_id instead.
+    std::string ID;
+    uint64_t numeric_id = 0;
+    double ra;
+    double dec;
+    std::vector<ObservationHandle> observations;
+    // With --sets, the target's entry in the sets table instead of observations.
+    int set = -1;
+
+    // The ID as written. buf needs room for 20 digits.
+    std::string_view id_text(char *buf) const {
+        if (!this->ID.empty()) return this->ID;
+        return {buf, static_cast<size_t>(std::to_chars(buf, buf + 20, this->numeric_id).ptr - buf)};
+    }
+};
+
+// Result writers. Chunks of targets are formatted in parallel into their own
+// buffers, a prefix sum over the buffer sizes gives each chunk's file offset,
+// and the chunks are written concurrently with pwrite. The bytes are identical
+// to formatting the results serially.
+
+// One row per target and FFI: ID,ra,dec,sector,camera,ccd. The file size is
+// computed up front so the file can be allocated in one go. If lookup is
+// given, it receives where each target's rows were written.
+void write_csv(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index,
+               std::vector<LookupEntry> *lookup = nullptr);
+
+// A JSON array of {ID, ra, dec, observations} objects, indented by 4 spaces.
+void write_json(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index);
+
+// path with its extension replaced by suffix: the name of a file written
+// alongside the results.
+std::string sidecar_path(const std::string &path, const char *suffix);
+
+// Output grouped by identical FFI sets (--sets). The CSV form writes one
+// ID,ra,dec,set row per target that falls on any FFI to path, and the sets
+// table as set,sector,camera,ccd rows to sets_csv_path(path). The JSON form
+// writes a single {"sets": [[obs_id, ...], ...], "targets": [...]} object.
+std::string sets_csv_path(const std::string &path);
+void write_csv_sets(const std::string &path, const std::vector<Target> &results,
+                    const std::vector<std::vector<ObservationHandle> > &sets, const IndexedPolygons &index,
+                    std::vector<LookupEntry> *lookup = nullptr);
+void write_json_sets(const std::string &path, const std::vector<Target> &results,
+                     const std::vector<std::vector<ObservationHandle> > &sets, const IndexedPolygons &index);
+
+// A targets × sectors matrix of uint8 with no header, one row per target in
+// results order and one column per sector of cube_sectors(). A cell is
+// (camera - 1) * 4 + ccd, or 0 where the sector didn't observe the target.
+// The columns' sectors go to cube_sectors_path(path) as column,sector rows
+// and the rows' targets to cube_targets_path(path) as ID,ra,dec rows.
+std::string cube_sectors_path(const std::string &path);
+std::string cube_targets_path(const std::string &path);
+// The cube's columns: every sector in the full footprint cache, ascending, so
+// the shape doesn't depend on which footprints --lazy loaded.
+std::vector<int> cube_sectors(const json &footprints);
+void write_cube(const std::string &path, const std::vector<Target> &results, const IndexedPolygons &index,
+                const std::vector<int> &sectors);
+
+// Input rows that were skipped, as row,reason,text with the original fields
+// quoted. Written in chunks like the results.
+std::string rejects_path(const std::string &path);
+void write_rejects(const std::string &path, const std::vector<RejectedRow> &rejects);
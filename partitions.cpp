@@ -0,0 +1,240 @@
+#include "partitions.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <s2/s1angle.h>
+#include <s2/s2region_coverer.h>
+
+#include "external/csv.h"
+
+// Row and column offsets of the twelve base pixels, as in HEALPix's jrll and
+// jpll tables.
+static constexpr int kFaceRow[12] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
+static constexpr int kFaceColumn[12] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
+
+// The point at coordinates (x, y) in [0, 1] within base pixel face; HEALPix's
+// xyf2loc.
+static S2Point face_point(int face, double x, double y) {
+    const double jr = kFaceRow[face] - x - y;
+    double nr, z, sth;
+    if (jr < 1) {
+        nr = jr;
+        const double t = nr * nr / 3;
+        z = 1 - t;
+        sth = std::sqrt(t * (2 - t));
+    } else if (jr > 3) {
+        nr = 4 - jr;
+        const double t = nr * nr / 3;
+        z = t - 1;
+        sth = std::sqrt(t * (2 - t));
+    } else {
+        nr = 1;
+        z = (2 - jr) * 2 / 3;
+        sth = std::sqrt((1 - z) * (1 + z));
+    }
+    double t = kFaceColumn[face] * nr + x - y;
+    if (t < 0) t += 8;
+    if (t >= 8) t -= 8;
+    const double phi = nr < 1e-15 ? 0 : M_PI / 4 * t / nr;
+    return S2Point(sth * std::cos(phi), sth * std::sin(phi), z);
+}
+
+// Every other bit of v, starting with the lowest.
+static uint64_t compress_bits(uint64_t v) {
+    uint64_t res = 0;
+    for (int i = 0; i < 32; ++i) res |= ((v >> (2 * i)) & 1) << i;
+    return res;
+}
+
+S2Cap healpix_cap(int order, uint64_t pixel) {
+    const uint64_t nside = uint64_t(1) << order;
+    const int face = static_cast<int>(pixel >> (2 * order));
+    const uint64_t in_face = pixel & (nside * nside - 1);
+    const double x0 = static_cast<double>(compress_bits(in_face)) / nside;
+    const double y0 = static_cast<double>(compress_bits(in_face >> 1)) / nside;
+    const double side = 1.0 / nside;
+    const S2Point center = face_point(face, x0 + side / 2, y0 + side / 2);
+
+    // Pixel edges aren't great circles, so walk the boundary. Every boundary
+    // point is within one step of a sample, which bounds the radius.
+    constexpr int kSteps = 16;
+    std::vector<S2Point> boundary;
+    for (int k = 0; k < kSteps; ++k) {
+        const double t = side * k / kSteps;
+        boundary.push_back(face_point(face, x0 + t, y0));
+    }
+    for (int k = 0; k < kSteps; ++k) {
+        const double t = side * k / kSteps;
+        boundary.push_back(face_point(face, x0 + side, y0 + t));
+    }
+    for (int k = 0; k < kSteps; ++k) {
+        const double t = side * k / kSteps;
+        boundary.push_back(face_point(face, x0 + side - t, y0 + side));
+    }
+    for (int k = 0; k < kSteps; ++k) {
+        const double t = side * k / kSteps;
+        boundary.push_back(face_point(face, x0, y0 + side - t));
+    }
+    S1Angle radius, step;
+    for (size_t i = 0; i < boundary.size(); ++i) {
+        radius = std::max(radius, S1Angle(center, boundary[i]));
+        step = std::max(step, S1Angle(boundary[i], boundary[(i + 1) % boundary.size()]));
+    }
+    return S2Cap(center, radius + step);
+}
+
+static std::filesystem::path dataset_dir(const std::string &root) {
+    const auto dataset = std::filesystem::path(root) / "dataset";
+    return std::filesystem::is_directory(dataset) ? dataset : std::filesystem::path(root);
+}
+
+static std::filesystem::path partition_path(const std::filesystem::path &base, int order, uint64_t pixel) {
+    return base / ("Norder=" + std::to_string(order)) / ("Dir=" + std::to_string(pixel / 10000 * 10000)) /
+        ("Npix=" + std::to_string(pixel) + ".csv");
+}
+
+// Parses the number after "<key>=" in name.
+template<typename T>
+static bool parse_key(const std::string &name, const std::string &key, T &value) {
+    if (name.size() <= key.size() + 1 || name.compare(0, key.size(), key) != 0 || name[key.size()] != '=') {
+        return false;
+    }
+    auto [ptr, ec] = std::from_chars(name.data() + key.size() + 1, name.data() + name.size(), value);
+    return ec == std::errc() && ptr == name.data() + name.size();
+}
+
+bool is_partitioned_catalog(const std::string &path) {
+    if (!std::filesystem::is_directory(path)) return false;
+    if (std::filesystem::exists(std::filesystem::path(path) / "partition_info.csv")) return true;
+    for (const auto &entry: std::filesystem::directory_iterator(dataset_dir(path))) {
+        int order;
+        if (entry.is_directory() && parse_key(entry.path().filename().string(), "Norder", order)) return true;
+    }
+    return false;
+}
+
+std::vector<Partition> list_partitions(const std::string &root) {
+    const auto base = dataset_dir(root);
+    std::vector<Partition> res;
+    const auto info = std::filesystem::path(root) / "partition_info.csv";
+    if (std::filesystem::exists(info)) {
+        csv::CSVReader reader(info.string());
+        const int order_column = reader.index_of("Norder");
+        const int pixel_column = reader.index_of("Npix");
+        if (order_column == csv::CSV_NOT_FOUND || pixel_column == csv::CSV_NOT_FOUND) {
+            throw std::runtime_error(info.string() + " has no Norder and Npix columns");
+        }
+        for (auto &row: reader) {
+            Partition p;
+            p.order = row[order_column].get<int>();
+            p.pixel = row[pixel_column].get<uint64_t>();
+            p.path = partition_path(base, p.order, p.pixel).string();
+            if (!std::filesystem::exists(p.path)) {
+                throw std::runtime_error("Missing partition " + p.path);
+            }
+            res.push_back(std::move(p));
+        }
+    } else {
+        for (const auto &entry: std::filesystem::recursive_directory_iterator(base)) {
+            if (!entry.is_regular_file() || entry.path().extension() != ".csv") continue;
+            Partition p;
+            if (!parse_key(entry.path().stem().string(), "Npix", p.pixel) ||
+                !parse_key(entry.path().parent_path().parent_path().filename().string(), "Norder", p.order)) {
+                continue;
+            }
+            p.path = entry.path().string();
+            res.push_back(std::move(p));
+        }
+    }
+
+    for (auto &p: res) {
+        if (p.order < 0 || p.order > 29 || p.pixel >= 12 * (uint64_t(1) << (2 * p.order))) {
+            throw std::runtime_error("Invalid HEALPix pixel in " + p.path);
+        }
+        p.cap = healpix_cap(p.order, p.pixel);
+    }
+    std::sort(res.begin(), res.end(), [](const Partition &a, const Partition &b) {
+        return std::tie(a.order, a.pixel) < std::tie(b.order, b.pixel);
+    });
+    return res;
+}
+
+S2CellUnion partitions_covering(const std::vector<Partition> &partitions) {
+    S2RegionCoverer::Options options;
+    options.set_max_cells(16);
+    S2RegionCoverer coverer(options);
+    std::vector<S2CellId> cells;
+    for (const auto &p: partitions) {
+        const auto covering = coverer.GetCovering(p.cap);
+        cells.insert(cells.end(), covering.begin(), covering.end());
+    }
+    return S2CellUnion(std::move(cells));
+}
+
+static void use_string_ids(Catalog &catalog) {
+    if (!catalog.numeric) return;
+    catalog.ids.resize(catalog.numeric_ids.size());
+    for (size_t i = 0; i < catalog.ids.size(); ++i) {
+        catalog.ids[i] = std::to_string(catalog.numeric_ids[i]);
+    }
+    catalog.numeric_ids = {};
+    catalog.numeric = false;
+}
+
+PartitionedCatalog read_partitions(const std::vector<Partition> &partitions, const IndexedPolygons &index,
+                                   InputBackend backend, IdType id_type) {
+    PartitionedCatalog res;
+    auto &catalog = res.catalog;
+    bool first = true;
+    size_t rows_read = 0;
+    for (const auto &p: partitions) {
+        std::vector<ObservationHandle> observations;
+        const bool uniform = index.search_cap(p.cap, observations);
+        if (uniform && observations.empty()) {
+            ++res.pruned;
+            continue;
+        }
+
+        Catalog part = read_catalog(p.path, backend, nullptr, id_type);
+        if (!part.has_positions) {
+            throw std::runtime_error(p.path + " has no ra/dec columns");
+        }
+        if (uniform) {
+            res.tag.insert(res.tag.end(), part.size(), static_cast<int32_t>(res.tags.size()));
+            res.tags.push_back(std::move(observations));
+            res.tagged_rows += part.size();
+            ++res.tagged;
+        } else {
+            res.tag.insert(res.tag.end(), part.size(), -1);
+            ++res.searched;
+        }
+
+        // Partitions can disagree on whether every ID is numeric; strings hold both.
+        if (first) {
+            catalog.numeric = part.numeric;
+            first = false;
+        } else if (catalog.numeric != part.numeric) {
+            use_string_ids(catalog);
+            use_string_ids(part);
+        }
+        if (catalog.numeric) {
+            catalog.numeric_ids.insert(catalog.numeric_ids.end(), part.numeric_ids.begin(), part.numeric_ids.end());
+        } else {
+            catalog.ids.insert(catalog.ids.end(), std::make_move_iterator(part.ids.begin()),
+                               std::make_move_iterator(part.ids.end()));
+        }
+        catalog.ra.insert(catalog.ra.end(), part.ra.begin(), part.ra.end());
+        catalog.dec.insert(catalog.dec.end(), part.dec.begin(), part.dec.end());
+        for (auto &reject: part.rejects) {
+            reject.row += rows_read;
+            catalog.rejects.push_back(std::move(reject));
+        }
+        rows_read += part.size() + part.rejects.size();
+    }
+    return res;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <s2/s2cap.h>
+#include <s2/s2cell_union.h>
+
+#include "catalog.h"
+#include "locator.h"
+
+// One HEALPix pixel of a partitioned catalog.
+struct Partition {
+    int order;
+    uint64_t pixel; // nested scheme
+    std::string path;
+    S2Cap cap;      // bounds the pixel
+};
+
+// A cap around the nested HEALPix pixel, with ra and dec as longitude and
+// latitude. Its radius errs on the large side.
+S2Cap healpix_cap(int order, uint64_t pixel);
+
+// Whether path is a directory of HEALPix partitions laid out like HATS
+// catalogs: Norder=<order>/Dir=<pixel / 10000 * 10000>/Npix=<pixel>.csv,
+// optionally under a dataset/ subdirectory.
+bool is_partitioned_catalog(const std::string &path);
+
+// Every partition of the catalog, ordered by order and pixel. Uses the
+// catalog's partition_info.csv when it has one and lists the directory
+// otherwise.
+std::vector<Partition> list_partitions(const std::string &root);
+
+// Union of coverings of the partitions' caps, for loading only the footprints
+// near them.
+S2CellUnion partitions_covering(const std::vector<Partition> &partitions);
+
+struct PartitionedCatalog {
+    // Rows of every partition that was read, in partition order. Rejected rows
+    // are numbered across the partitions that were read.
+    Catalog catalog;
+
+    // Partitions that lie wholly inside the same footprints are not searched
+    // row by row: tag[i] is the index into tags of row i's observations, or -1
+    // if the row still has to be searched.
+    std::vector<int32_t> tag;
+    std::vector<std::vector<ObservationHandle> > tags;
+
+    size_t pruned = 0;      // partitions skipped because no footprint reaches them
+    size_t tagged = 0;      // partitions read but not searched
+    size_t searched = 0;    // partitions searched row by row
+    size_t tagged_rows = 0;
+};
+
+// Reads the partitions that can contain hits. Needs an index holding every
+// footprint that could match; partitions are classified against it with
+// IndexedPolygons::search_cap().
+PartitionedCatalog read_partitions(const std::vector<Partition> &partitions, const IndexedPolygons &index,
+                                   InputBackend backend = InputBackend::automatic,
+                                   IdType id_type = IdType::automatic);
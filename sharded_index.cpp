@@ -0,0 +1,79 @@
+#include "sharded_index.h"
+
+#include <algorithm>
+#include <map>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+ShardedIndex::ShardedIndex(const json &footprints, const MutableS2ShapeIndex::Options &options,
+                           int sectors_per_shard, int threads) {
+#ifdef USE_OPENMP
+    this->threads = threads > 0 ? threads : omp_get_max_threads();
+#else
+    this->threads = 1;
+#endif
+    sectors_per_shard = std::max(1, sectors_per_shard);
+
+    // Split the footprint lists, remembering each footprint's combined handle.
+    const auto &ids = footprints["obs_id"];
+    const auto &regions = footprints["s_region"];
+    std::map<int, json> parts;
+    std::map<int, std::vector<ObservationHandle> > handles;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const auto &obs = ids[i].get_ref<const std::string &>();
+        const int shard = (std::stoi(obs.substr(6, 4)) - 1) / sectors_per_shard;
+        auto &part = parts[shard];
+        part["obs_id"].push_back(ids[i]);
+        part["s_region"].push_back(regions[i]);
+        handles[shard].push_back(static_cast<ObservationHandle>(i));
+        this->names.push_back(obs);
+    }
+
+    std::vector<int> keys;
+    for (const auto &[key, part]: parts) keys.push_back(key);
+    this->shards.resize(keys.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int s = 0; s < static_cast<int>(keys.size()); ++s) {
+        const auto &part = parts.at(keys[s]);
+        auto shard = std::unique_ptr<Shard>(new Shard{IndexedPolygons::build(part, options), S2Cap::Empty(),
+                                                      std::move(handles.at(keys[s]))});
+        shard->index.force_build();
+        for (const auto &region: part["s_region"]) {
+            S2Cap cap;
+            if (!region_cap(region.get_ref<const std::string &>(), cap)) {
+                shard->cap = S2Cap::Full();
+                break;
+            }
+            shard->cap.AddCap(cap);
+        }
+        this->shards[s] = std::move(shard);
+    }
+}
+
+void ShardedIndex::search(const S2Point &point, std::vector<ObservationHandle> &res) const {
+    std::vector<const Shard *> candidates;
+    for (const auto &shard: this->shards) {
+        if (shard->cap.Contains(point)) candidates.push_back(shard.get());
+    }
+
+    std::vector<std::vector<ObservationHandle> > found(candidates.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for num_threads(std::clamp(static_cast<int>(candidates.size()), 1, this->threads)) \
+    schedule(dynamic, 1) \
+    if(candidates.size() > 1 && !omp_in_parallel())
+#endif
+    for (int k = 0; k < static_cast<int>(candidates.size()); ++k) {
+        candidates[k]->index.search(point, Engine::index, found[k]);
+        for (auto &h: found[k]) h = candidates[k]->handles[h];
+    }
+
+    // Each shard's handles ascend; shards interleave when the footprint list
+    // isn't ordered by sector.
+    const size_t first = res.size();
+    for (const auto &f: found) res.insert(res.end(), f.begin(), f.end());
+    std::sort(res.begin() + first, res.end());
+}
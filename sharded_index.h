@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <s2/s2cap.h>
+#include "locator.h"
+
+// The footprints split into sub-indexes by sector, for low-latency lookups of
+// single positions: a point's shards are searched concurrently by a small
+// team of threads and their results merged, instead of one thread walking the
+// combined index. A cap around each shard's footprints skips shards that
+// can't contain the point. Handles and names match an IndexedPolygons built
+// from the same footprints.
+//
+// Called from inside a parallel region (a batch over many rows), search()
+// runs the shards on the calling thread, so batch throughput is unchanged.
+class ShardedIndex {
+    struct Shard {
+        IndexedPolygons index;
+        S2Cap cap;                              // bounds every footprint in the shard
+        std::vector<ObservationHandle> handles; // the combined handle of each of the shard's footprints
+    };
+
+    std::vector<std::unique_ptr<Shard> > shards;
+    std::vector<std::string> names;
+    int threads;
+
+public:
+    // Groups sectors_per_shard consecutive sectors per shard (13 is about a
+    // year of the mission) and builds every shard's index. threads caps the
+    // team for one search(), which never exceeds the shards whose caps hold
+    // the point; 0 means all cores.
+    ShardedIndex(const json &footprints, const MutableS2ShapeIndex::Options &options, int sectors_per_shard,
+                 int threads = 0);
+
+    size_t size() const {
+        return this->names.size();
+    }
+
+    size_t shard_count() const {
+        return this->shards.size();
+    }
+
+    const std::string &name(ObservationHandle handle) const {
+        return this->names[handle];
+    }
+
+    // Appends the footprints containing point to res, in ascending handle order.
+    void search(const S2Point &point, std::vector<ObservationHandle> &res) const;
+};
@@ -0,0 +1,223 @@
+#include "tic_index.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "external/csv.h"
+#include "locator.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+static constexpr char kMagic[8] = "TICIDX1";
+
+TicIndex::TicIndex(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open TIC index: " + path);
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    this->map_size = st.st_size;
+    if (this->map_size < 16) {
+        close(fd);
+        throw std::runtime_error("Invalid TIC index: " + path);
+    }
+    this->map = mmap(nullptr, this->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->map == MAP_FAILED) {
+        this->map = nullptr;
+        throw std::runtime_error("Failed to map TIC index: " + path);
+    }
+
+    const auto *base = static_cast<const char *>(this->map);
+    std::memcpy(&this->count, base + 8, sizeof(this->count));
+    if (std::memcmp(base, kMagic, sizeof(kMagic)) != 0 || this->count > (this->map_size - 16) / 24 ||
+        this->map_size != 16 + 24 * this->count) {
+        munmap(this->map, this->map_size);
+        this->map = nullptr;
+        throw std::runtime_error("Invalid TIC index: " + path);
+    }
+    this->ids = reinterpret_cast<const uint64_t *>(base + 16);
+    this->ra = reinterpret_cast<const double *>(base + 16 + 8 * this->count);
+    this->dec = reinterpret_cast<const double *>(base + 16 + 16 * this->count);
+    madvise(this->map, this->map_size, MADV_RANDOM);
+}
+
+TicIndex::~TicIndex() {
+    if (this->map) munmap(this->map, this->map_size);
+}
+
+int64_t TicIndex::find(uint64_t id) const {
+    if (this->count == 0) return -1;
+
+    // TIC IDs are close to uniformly distributed, so a few interpolation steps
+    // land next to the answer; a binary search finishes the job if they don't.
+    uint64_t lo = 0, hi = this->count - 1;
+    for (int step = 0; step < 4 && lo < hi; ++step) {
+        const uint64_t a = this->ids[lo], b = this->ids[hi];
+        if (id < a || id > b) return -1;
+        if (a == b) break;
+        const uint64_t mid = lo + static_cast<uint64_t>(static_cast<long double>(id - a) / (b - a) * (hi - lo));
+        if (this->ids[mid] == id) return mid;
+        if (this->ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    const uint64_t *it = std::lower_bound(this->ids + lo, this->ids + hi + 1, id);
+    return it != this->ids + hi + 1 && *it == id ? it - this->ids : -1;
+}
+
+std::string default_tic_index_path() {
+    return (std::filesystem::path(cache_dir()) / "tic_index.bin").string();
+}
+
+bool parse_tic_id(std::string_view text, uint64_t &id) {
+    while (!text.empty() && text.front() == ' ') text.remove_prefix(1);
+    if (text.substr(0, 3) == "TIC") text.remove_prefix(3);
+    while (!text.empty() && (text.front() == ' ' || text.front() == '_' || text.front() == '-')) text.remove_prefix(1);
+    while (!text.empty() && text.back() == ' ') text.remove_suffix(1);
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), id);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+void build_tic_index(const std::string &csv_path, const std::string &out_path) {
+    struct Entry {
+        uint64_t id;
+        double ra;
+        double dec;
+    };
+    std::vector<Entry> entries;
+    size_t invalid = 0, bad_position = 0;
+
+    // Bad rows are counted and skipped, so one of them doesn't end a long build.
+    auto format = csv::CSVFormat::guess_csv();
+    format.variable_columns(csv::VariableColumnPolicy::KEEP);
+    csv::CSVReader reader(csv_path, format);
+    for (const char *column: {"ID", "ra", "dec"}) {
+        if (reader.index_of(column) == csv::CSV_NOT_FOUND) {
+            throw std::runtime_error(csv_path + " has no " + column + " column");
+        }
+    }
+    const size_t columns = reader.get_col_names().size();
+    const size_t id = reader.index_of("ID"), ra = reader.index_of("ra"), dec = reader.index_of("dec");
+    for (auto &row: reader) {
+        Entry e{};
+        if (row.size() != columns || !parse_tic_id(row[id].get_sv(), e.id)) {
+            ++invalid;
+            continue;
+        }
+        const auto ra_text = row[ra].get_sv(), dec_text = row[dec].get_sv();
+        if (parse_position(std::string_view(ra_text.data(), ra_text.size()),
+                           std::string_view(dec_text.data(), dec_text.size()), e.ra, e.dec) != RowStatus::ok) {
+            ++bad_position;
+            continue;
+        }
+        entries.push_back(e);
+    }
+    if (invalid > 0) {
+        std::cerr << "Skipped " << invalid << " rows with non-numeric IDs or the wrong number of columns."
+            << std::endl;
+    }
+    if (bad_position > 0) {
+        std::cerr << "Skipped " << bad_position << " rows with invalid ra or dec." << std::endl;
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.id < b.id; });
+    const auto last = std::unique(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.id == b.id;
+    });
+    if (last != entries.end()) {
+        std::cerr << "Dropped " << entries.end() - last << " duplicate IDs." << std::endl;
+        entries.erase(last, entries.end());
+    }
+
+    std::filesystem::path out(out_path);
+    if (out.has_parent_path()) std::filesystem::create_directories(out.parent_path());
+    const std::string tmp = out_path + ".tmp";
+    std::ofstream file(tmp, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + tmp);
+    }
+
+    const uint64_t count = entries.size();
+    file.write(kMagic, sizeof(kMagic));
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    std::vector<char> column;
+    auto write_column = [&](auto field) {
+        using T = decltype(field(entries[0]));
+        column.resize(entries.size() * sizeof(T));
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const T value = field(entries[i]);
+            std::memcpy(column.data() + i * sizeof(T), &value, sizeof(T));
+        }
+        file.write(column.data(), column.size());
+    };
+    if (count > 0) {
+        write_column([](const Entry &e) { return e.id; });
+        write_column([](const Entry &e) { return e.ra; });
+        write_column([](const Entry &e) { return e.dec; });
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write " + tmp);
+    }
+    std::filesystem::rename(tmp, out_path);
+    std::cout << "Wrote " << count << " TIC positions to " << out_path << "." << std::endl;
+}
+
+size_t resolve_positions(Catalog &catalog, const TicIndex &index) {
+    const int64_t n = catalog.size();
+    std::vector<int64_t> found(n);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int64_t i = 0; i < n; ++i) {
+        uint64_t id;
+        if (catalog.numeric) {
+            found[i] = index.find(catalog.numeric_ids[i]);
+        } else {
+            found[i] = parse_tic_id(catalog.ids[i], id) ? index.find(id) : -1;
+        }
+    }
+
+    // Compact the resolved rows in input order.
+    catalog.ra.resize(n);
+    catalog.dec.resize(n);
+    int64_t kept = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        if (found[i] < 0) continue;
+        if (kept != i) {
+            if (catalog.numeric) {
+                catalog.numeric_ids[kept] = catalog.numeric_ids[i];
+            } else {
+                catalog.ids[kept] = std::move(catalog.ids[i]);
+            }
+        }
+        catalog.ra[kept] = index.ra_at(found[i]);
+        catalog.dec[kept] = index.dec_at(found[i]);
+        ++kept;
+    }
+    if (catalog.numeric) {
+        catalog.numeric_ids.resize(kept);
+    } else {
+        catalog.ids.resize(kept);
+    }
+    catalog.ra.resize(kept);
+    catalog.dec.resize(kept);
+    catalog.has_positions = true;
+    return n - kept;
+}
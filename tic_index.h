@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "catalog.h"
+
+// A sorted (TIC ID -> ra, dec) table that is memory mapped for lookups.
+//
+// File layout (native endianness):
+//   char     magic[8]    "TICIDX1"
+//   uint64_t count
+//   uint64_t ids[count]  ascending
+//   double   ra[count]
+//   double   dec[count]
+class TicIndex {
+    void *map = nullptr;
+    size_t map_size = 0;
+    const uint64_t *ids = nullptr;
+    const double *ra = nullptr;
+    const double *dec = nullptr;
+    uint64_t count = 0;
+
+public:
+    explicit TicIndex(const std::string &path);
+    ~TicIndex();
+    TicIndex(const TicIndex &) = delete;
+    TicIndex &operator=(const TicIndex &) = delete;
+
+    // Row of id in the table, or -1 if it is not present.
+    int64_t find(uint64_t id) const;
+
+    uint64_t size() const {
+        return this->count;
+    }
+
+    double ra_at(int64_t row) const {
+        return this->ra[row];
+    }
+
+    double dec_at(int64_t row) const {
+        return this->dec[row];
+    }
+};
+
+// Default location of the TIC index, next to the footprint cache.
+std::string default_tic_index_path();
+
+// Parses a TIC ID, with or without a "TIC" prefix.
+bool parse_tic_id(std::string_view text, uint64_t &id);
+
+// Converts a CSV extract with columns ID, ra, dec into a TicIndex file.
+void build_tic_index(const std::string &csv_path, const std::string &out_path);
+
+// Fills in the positions of an ID-only catalog from the index. Rows whose ID is
+// not in the index are dropped; returns how many.
+size_t resolve_positions(Catalog &catalog, const TicIndex &index);
@@ -0,0 +1,74 @@
+#include "verify.h"
+
+#include <algorithm>
+#include <cmath>
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+ShadowVerifier::ShadowVerifier(const IndexedPolygons &index, double fraction, uint64_t seed, int threads)
+    : index(index), seed(seed), slots(std::max(1, threads)) {
+    fraction = std::clamp(fraction, 0.0, 1.0);
+    this->threshold = fraction >= 1 ? UINT64_MAX : static_cast<uint64_t>(std::ldexp(fraction, 64));
+}
+
+bool ShadowVerifier::sampled(size_t row) const {
+    return this->threshold == UINT64_MAX || splitmix64(this->seed ^ row) < this->threshold;
+}
+
+void ShadowVerifier::check(int thread, size_t row, const std::string &ID, double ra, double dec,
+                           const std::vector<ObservationHandle> &handles) {
+    auto &slot = this->slots[thread];
+    ++slot.checked;
+
+    std::vector<ObservationHandle> expected;
+    this->index.search_index(radec_point(ra, dec), expected);
+    std::vector<ObservationHandle> actual = handles;
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    if (expected != actual) {
+        slot.mismatches.push_back({row, ID, ra, dec, std::move(expected), std::move(actual)});
+    }
+}
+
+size_t ShadowVerifier::checked() const {
+    size_t total = 0;
+    for (const auto &slot: this->slots) total += slot.checked;
+    return total;
+}
+
+std::vector<ShadowVerifier::Mismatch> ShadowVerifier::mismatches() const {
+    std::vector<Mismatch> res;
+    for (const auto &slot: this->slots) {
+        res.insert(res.end(), slot.mismatches.begin(), slot.mismatches.end());
+    }
+    std::sort(res.begin(), res.end(), [](const Mismatch &a, const Mismatch &b) { return a.row < b.row; });
+    return res;
+}
+
+void ShadowVerifier::report(std::ostream &out, size_t limit) const {
+    const auto all = this->mismatches();
+    out << "Verified " << this->checked() << " rows against the reference path: " << all.size()
+        << " mismatches." << std::endl;
+
+    auto names = [&](const std::vector<ObservationHandle> &handles) {
+        std::string res;
+        for (const auto &h: handles) {
+            if (!res.empty()) res += ' ';
+            res += this->index.name(h);
+        }
+        return res.empty() ? std::string("none") : res;
+    };
+    for (size_t i = 0; i < std::min(limit, all.size()); ++i) {
+        const auto &m = all[i];
+        out << "  row " << m.row + 1 << " " << m.ID << " (ra " << m.ra << ", dec " << m.dec << "): expected "
+            << names(m.expected) << ", got " << names(m.actual) << std::endl;
+    }
+    if (all.size() > limit) {
+        out << "  ... and " << all.size() - limit << " more" << std::endl;
+    }
+}
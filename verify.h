@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "locator.h"
+
+// Re-checks a random fraction of queries against the reference
+// S2ContainsPointQuery path (IndexedPolygons::search_index()), so faster
+// engines can run in production without silently disagreeing near CCD
+// edges. check() is called from the query loop by the thread that owns the
+// slot; the extra cost is one reference lookup per sampled row.
+class ShadowVerifier {
+public:
+    struct Mismatch {
+        size_t row;
+        std::string ID;
+        double ra, dec;
+        std::vector<ObservationHandle> expected; // from the reference path
+        std::vector<ObservationHandle> actual;   // from the engine that ran
+    };
+
+private:
+    struct alignas(64) Slot {
+        size_t checked = 0;
+        std::vector<Mismatch> mismatches;
+    };
+
+    const IndexedPolygons &index;
+    uint64_t threshold; // rows whose hash is below this are checked
+    uint64_t seed;
+    std::vector<Slot> slots;
+
+public:
+    ShadowVerifier(const IndexedPolygons &index, double fraction, uint64_t seed, int threads);
+
+    bool sampled(size_t row) const;
+
+    // Compares handles found by the engine for a row against the reference.
+    void check(int thread, size_t row, const std::string &ID, double ra, double dec,
+               const std::vector<ObservationHandle> &handles);
+
+    size_t checked() const;
+
+    // All mismatches in row order.
+    std::vector<Mismatch> mismatches() const;
+
+    // Prints a summary and up to limit mismatches with their coordinates.
+    void report(std::ostream &out, size_t limit = 20) const;
+};
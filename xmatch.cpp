@@ -0,0 +1,133 @@
+#include "xmatch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+#include <s2/s1chord_angle.h>
+#include <s2/s2closest_point_query.h>
+#include <s2/s2point_index.h>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+static int max_threads() {
+#ifdef USE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// A catalog's rows grouped by the footprints containing them: the rows on
+// footprint h are rows[offsets[h]] up to rows[offsets[h + 1]].
+struct FootprintRows {
+    std::vector<S2Point> points;
+    std::vector<size_t> offsets;
+    std::vector<size_t> rows;
+};
+
+static FootprintRows locate_rows(const Catalog &catalog, const IndexedPolygons &index) {
+    FootprintRows res;
+    const int64_t n = catalog.size();
+    res.points.resize(n);
+    std::vector<std::vector<ObservationHandle> > hits(n);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+    for (int64_t i = 0; i < n; ++i) {
+        res.points[i] = radec_point(catalog.ra[i], catalog.dec[i]);
+        index.search(res.points[i], Engine::index, hits[i]);
+    }
+
+    res.offsets.assign(index.size() + 1, 0);
+    for (const auto &row_hits: hits) {
+        for (auto h: row_hits) ++res.offsets[h + 1];
+    }
+    for (size_t h = 0; h < index.size(); ++h) res.offsets[h + 1] += res.offsets[h];
+    res.rows.resize(res.offsets.back());
+    std::vector<size_t> next(res.offsets.begin(), res.offsets.end() - 1);
+    for (int64_t i = 0; i < n; ++i) {
+        for (auto h: hits[i]) res.rows[next[h]++] = i;
+    }
+    return res;
+}
+
+std::vector<CrossMatch> cross_match(const Catalog &a, const Catalog &b, const IndexedPolygons &index,
+                                    S1Angle radius) {
+    if (!a.has_positions || !b.has_positions) {
+        throw std::runtime_error("Cross-matching needs ra and dec in both catalogs");
+    }
+    const FootprintRows rows_a = locate_rows(a, index);
+    const FootprintRows rows_b = locate_rows(b, index);
+
+    // (a, b, footprint) for every pair within the radius on a shared footprint.
+    using Pair = std::tuple<size_t, size_t, ObservationHandle>;
+    std::vector<std::vector<Pair> > thread_pairs(max_threads());
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int h = 0; h < static_cast<int>(index.size()); ++h) {
+        const size_t a_begin = rows_a.offsets[h], a_end = rows_a.offsets[h + 1];
+        const size_t b_begin = rows_b.offsets[h], b_end = rows_b.offsets[h + 1];
+        if (a_begin == a_end || b_begin == b_end) continue;
+#ifdef USE_OPENMP
+        auto &pairs = thread_pairs[omp_get_thread_num()];
+#else
+        auto &pairs = thread_pairs[0];
+#endif
+
+        S2PointIndex<size_t> points;
+        for (size_t k = b_begin; k < b_end; ++k) {
+            points.Add(rows_b.points[rows_b.rows[k]], rows_b.rows[k]);
+        }
+        S2ClosestPointQuery<size_t> query(&points);
+        query.mutable_options()->set_inclusive_max_distance(S1ChordAngle(radius));
+        for (size_t k = a_begin; k < a_end; ++k) {
+            const size_t row = rows_a.rows[k];
+            S2ClosestPointQuery<size_t>::PointTarget target(rows_a.points[row]);
+            for (const auto &result: query.FindClosestPoints(&target)) {
+                pairs.emplace_back(row, result.data(), h);
+            }
+        }
+    }
+
+    std::vector<Pair> pairs;
+    for (auto &p: thread_pairs) {
+        pairs.insert(pairs.end(), p.begin(), p.end());
+        p = {};
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    // A pair shows up once per shared footprint.
+    std::vector<CrossMatch> res;
+    for (const auto &[row_a, row_b, h]: pairs) {
+        if (res.empty() || res.back().a != row_a || res.back().b != row_b) {
+            res.push_back({row_a, row_b, S1Angle(rows_a.points[row_a], rows_b.points[row_b]), {}});
+        }
+        res.back().shared.push_back(h);
+    }
+    return res;
+}
+
+void write_cross_matches(const std::string &path, const Catalog &a, const Catalog &b,
+                         const std::vector<CrossMatch> &matches, const IndexedPolygons &index) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    file << "ID_a,ID_b,separation,ffis\n";
+    for (const auto &m: matches) {
+        file << a.id(m.a) << ',' << b.id(m.b) << ',' << m.separation.degrees() * 3600 << ',';
+        for (size_t i = 0; i < m.shared.size(); ++i) {
+            if (i > 0) file << ';';
+            file << index.name(m.shared[i]);
+        }
+        file << '\n';
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <s2/s1angle.h>
+
+#include "catalog.h"
+#include "locator.h"
+
+// A row of catalog A and a row of catalog B within the match radius that lie
+// on at least one common FFI.
+struct CrossMatch {
+    size_t a;
+    size_t b;
+    S1Angle separation;
+    std::vector<ObservationHandle> shared; // ascending
+};
+
+// Locates both catalogs, groups their rows by footprint and radius matches
+// A against B inside each footprint's group in parallel, so only stars that
+// share an FFI are ever compared. Matches are ordered by a, then b.
+std::vector<CrossMatch> cross_match(const Catalog &a, const Catalog &b, const IndexedPolygons &index,
+                                    S1Angle radius);
+
+// Writes ID_a,ID_b,separation (arcsec),ffis, with the shared obs_ids
+// separated by ';'.
+void write_cross_matches(const std::string &path, const Catalog &a, const Catalog &b,
+                         const std::vector<CrossMatch> &matches, const IndexedPolygons &index);